@@ -0,0 +1,236 @@
+/***************************************************************************
+
+ liblightpen - userspace access to the Raspberry Pi GPIO lightpen driver
+
+ Copyright (c) 2020 Maciej Witkowiak
+
+ Licensed under The MIT License (MIT), see rpi_lightpen.c for details
+
+***************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include "lightpen.h"
+
+#define PAL_LINE_LENGTH 64
+
+// ------------------ Device ------------------------------------------------
+
+int lp_open(struct lp_dev *dev, const char *device, int flags) {
+    dev->fd = open(device ? device : LP_DEVICE, O_RDONLY | flags);
+    if (dev->fd < 0)
+        return -errno;
+    return 0;
+}
+
+void lp_close(struct lp_dev *dev) {
+    if (dev->fd >= 0)
+        close(dev->fd);
+    dev->fd = -1;
+}
+
+static int lp_ioctl(struct lp_dev *dev, unsigned long cmd, void *arg) {
+    if (ioctl(dev->fd, cmd, arg) < 0)
+        return -errno;
+    return 0;
+}
+
+int lp_set_mode(struct lp_dev *dev, int mode) {
+    if (ioctl(dev->fd, LIGHTPEN_IOC_SET_MODE, mode) < 0)
+        return -errno;
+    return 0;
+}
+
+int lp_set_calib(struct lp_dev *dev, const struct lightpen_calib *calib) {
+    return lp_ioctl(dev, LIGHTPEN_IOC_SET_CALIB, (void *)calib);
+}
+
+int lp_set_zones(struct lp_dev *dev, const struct lightpen_zones *zones) {
+    return lp_ioctl(dev, LIGHTPEN_IOC_SET_ZONES, (void *)zones);
+}
+
+int lp_set_machine(struct lp_dev *dev, struct lightpen_machine *machine) {
+    return lp_ioctl(dev, LIGHTPEN_IOC_SET_MACHINE, machine);
+}
+
+int lp_arm_trigger(struct lp_dev *dev, const struct lightpen_trigger *trigger) {
+    return lp_ioctl(dev, LIGHTPEN_IOC_ARM_TRIGGER, (void *)trigger);
+}
+
+int lp_set_eventfd(struct lp_dev *dev, int efd, uint32_t flags) {
+    struct lightpen_eventfd evfd = { .fd = efd, .flags = flags };
+
+    return lp_ioctl(dev, LIGHTPEN_IOC_SET_EVENTFD, &evfd);
+}
+
+int lp_get_frame(struct lp_dev *dev, uint32_t *frame) {
+    return lp_ioctl(dev, LIGHTPEN_IOC_GET_FRAME, frame);
+}
+
+int lp_get_vsync(struct lp_dev *dev, struct lightpen_vsync *vsync) {
+    return lp_ioctl(dev, LIGHTPEN_IOC_GET_VSYNC, vsync);
+}
+
+int lp_set_watermark(struct lp_dev *dev, uint32_t watermark) {
+    if (ioctl(dev->fd, LIGHTPEN_IOC_SET_WATERMARK, (unsigned long)watermark) < 0)
+        return -errno;
+    return 0;
+}
+
+int lp_set_timeout(struct lp_dev *dev, uint32_t ms) {
+    if (ioctl(dev->fd, LIGHTPEN_IOC_SET_TIMEOUT, (unsigned long)ms) < 0)
+        return -errno;
+    return 0;
+}
+
+ssize_t lp_read_records(struct lp_dev *dev, struct lightpen_record *buf, size_t count) {
+    ssize_t lg = read(dev->fd, buf, count * sizeof(*buf));
+
+    if (lg < 0)
+        return -errno;
+    return lg / sizeof(*buf);
+}
+
+// ------------------ Calibration -------------------------------------------
+
+void lp_calib_compute(struct lightpen_calib *calib, int col0, int line0, int col1, int line1, int width, int height) {
+    int rangex = col1 - col0;
+    int rangey = line1 - line0;
+
+    if (rangex <= 0)
+        rangex += PAL_LINE_LENGTH;
+    if (rangey < 0)
+        rangey = -rangey;
+    if (rangey == 0)
+        rangey = 1;
+    calib->offsx = col0;
+    calib->offsy = line0;
+    calib->scalex = (256 * width) / rangex;
+    calib->scaley = (256 * height) / rangey;
+}
+
+void lp_calib_apply(const struct lightpen_calib *calib, int col, int line, int *x, int *y) {
+    int xoffs = col - calib->offsx;
+
+    if (xoffs < 0)
+        xoffs += PAL_LINE_LENGTH;
+    *x = (xoffs * calib->scalex) >> 8;
+    *y = ((line - calib->offsy) * calib->scaley) >> 8;
+}
+
+// ------------------ Beam position -----------------------------------------
+
+void lp_beam_position(const struct lightpen_vsync *vsync, uint64_t t, uint32_t *line, uint32_t *ns) {
+    uint64_t offset = 0;
+
+    // no VSYNC measured yet
+    if ((vsync->frame_period == 0) || (vsync->line_period == 0)) {
+        *line = 0;
+        *ns = 0;
+        return;
+    }
+    if (t > vsync->timestamp)
+        offset = (t - vsync->timestamp) % vsync->frame_period;
+    *line = offset / vsync->line_period;
+    *ns = offset % vsync->line_period;
+}
+
+uint64_t lp_beam_time(const struct lightpen_vsync *vsync, uint64_t t, uint32_t line) {
+    uint64_t start = vsync->timestamp;
+    uint64_t when;
+
+    if (vsync->frame_period == 0)
+        return t;
+    // beginning of the field the beam is in at t
+    if (t > start)
+        start += (t - start) / vsync->frame_period * vsync->frame_period;
+    when = start + (uint64_t)line * vsync->line_period;
+    if (when < t)
+        when += vsync->frame_period;
+    return when;
+}
+
+// ------------------ Shared memory page ------------------------------------
+
+int lp_shm_open(struct lp_shm *shm, const char *device) {
+    void *page;
+    int fd;
+
+    fd = open(device ? device : LP_DEVICE, O_RDONLY);
+    if (fd < 0)
+        return -errno;
+    page = mmap(NULL, sizeof(struct lightpen_shared), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (page == MAP_FAILED)
+        return -errno;
+    shm->page = page;
+    return 0;
+}
+
+void lp_shm_close(struct lp_shm *shm) {
+    if (shm->page != NULL)
+        munmap((void *)shm->page, sizeof(struct lightpen_shared));
+    shm->page = NULL;
+}
+
+//
+// seq is odd while the driver writes, retry until we copied a stable page
+//
+void lp_shm_snapshot(const struct lp_shm *shm, struct lightpen_shared *snap) {
+    uint32_t seq;
+
+    for (;;) {
+        seq = __atomic_load_n(&shm->page->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+            continue;
+        memcpy(snap, shm->page, sizeof(*snap));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&shm->page->seq, __ATOMIC_RELAXED) == seq)
+            return;
+    }
+}
+
+size_t lp_shm_next(const struct lp_shm *shm, uint64_t *last, struct lightpen_record *rec) {
+    struct lightpen_shared snap;
+
+    lp_shm_snapshot(shm, &snap);
+    if (snap.sample.timestamp == *last)
+        return 0;
+    *last = snap.sample.timestamp;
+    *rec = snap.sample;
+    return 1;
+}
+
+// screen position to -0x7fff..0x7fff
+static int lp_lightgun_scale(int pos, int size) {
+    if (size <= 1)
+        return 0;
+    if (pos < 0)
+        pos = 0;
+    if (pos >= size)
+        pos = size - 1;
+    return (pos * 0xfffe) / (size - 1) - 0x7fff;
+}
+
+int lp_lightgun_query(const struct lp_shm *shm, enum lp_lightgun_id id, int width, int height) {
+    struct lightpen_shared snap;
+
+    lp_shm_snapshot(shm, &snap);
+
+    switch (id) {
+        case LP_LIGHTGUN_TRIGGER:
+            return snap.button == 0;
+        case LP_LIGHTGUN_SCREEN_X:
+            return lp_lightgun_scale(snap.x, width);
+        case LP_LIGHTGUN_SCREEN_Y:
+            return lp_lightgun_scale(snap.y, height);
+        case LP_LIGHTGUN_IS_OFFSCREEN:
+            return snap.offscreen || (snap.x < 0) || (snap.x >= width) || (snap.y < 0) || (snap.y >= height);
+    }
+    return 0;
+}
@@ -0,0 +1,126 @@
+/***************************************************************************
+
+ liblightpen - userspace access to the Raspberry Pi GPIO lightpen driver
+
+ Copyright (c) 2020 Maciej Witkowiak
+
+ Licensed under The MIT License (MIT), see rpi_lightpen.c for details
+
+***************************************************************************/
+
+#ifndef _LIGHTPEN_H
+#define _LIGHTPEN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "rpi_lightpen.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LP_DEVICE "/dev/lightpen0"
+
+// ------------------ Device ------------------------------------------------
+
+struct lp_dev {
+    int fd;
+};
+
+// flags are passed to open(), e.g. O_NONBLOCK; all functions return 0 or -errno
+int lp_open(struct lp_dev *dev, const char *device, int flags);
+void lp_close(struct lp_dev *dev);
+
+// file descriptor for poll()/epoll/select() based event loops
+static inline int lp_fd(const struct lp_dev *dev) { return dev->fd; }
+
+// mode is shared by all open files of the pen, -EBUSY if other files are open
+int lp_set_mode(struct lp_dev *dev, int mode);
+int lp_set_calib(struct lp_dev *dev, const struct lightpen_calib *calib);
+int lp_set_zones(struct lp_dev *dev, const struct lightpen_zones *zones);
+int lp_set_machine(struct lp_dev *dev, struct lightpen_machine *machine);
+int lp_arm_trigger(struct lp_dev *dev, const struct lightpen_trigger *trigger);
+int lp_get_frame(struct lp_dev *dev, uint32_t *frame);
+int lp_get_vsync(struct lp_dev *dev, struct lightpen_vsync *vsync);
+// readable after that many records/events or LIGHTPEN_WATERMARK_FRAME, for this descriptor only
+int lp_set_watermark(struct lp_dev *dev, uint32_t watermark);
+// blocking reads return a LIGHTPEN_FIELD_NODATA record after ms milliseconds without data, 0 waits forever
+int lp_set_timeout(struct lp_dev *dev, uint32_t ms);
+// signal eventfd on LIGHTPEN_EVENTFD_VSYNC and/or LIGHTPEN_EVENTFD_HIT, efd -1 unregisters
+int lp_set_eventfd(struct lp_dev *dev, int efd, uint32_t flags);
+
+// read binary records (LIGHTPEN_MODE_RECORD) into caller's buffer, returns number of records or -errno
+ssize_t lp_read_records(struct lp_dev *dev, struct lightpen_record *buf, size_t count);
+
+// ------------------ Record iterator ---------------------------------------
+
+// walks records in place, no copies and no allocation
+struct lp_iter {
+    const struct lightpen_record *cur;
+    const struct lightpen_record *end;
+};
+
+static inline void lp_iter_init(struct lp_iter *it, const struct lightpen_record *buf, size_t count) {
+    it->cur = buf;
+    it->end = buf + count;
+}
+
+// next record or NULL when done
+static inline const struct lightpen_record *lp_iter_next(struct lp_iter *it) {
+    return (it->cur < it->end) ? it->cur++ : NULL;
+}
+
+// ------------------ Calibration -------------------------------------------
+
+// 8.8 fixed-point calibration from raw positions of top-left and bottom-right screen corners
+void lp_calib_compute(struct lightpen_calib *calib, int col0, int line0, int col1, int line1, int width, int height);
+
+// raw column/line to screen position, same math as the driver
+void lp_calib_apply(const struct lightpen_calib *calib, int col, int line, int *x, int *y);
+
+// ------------------ Beam position -----------------------------------------
+
+// use with lp_get_vsync() or the vsync part of lp_shm_snapshot(), t is CLOCK_MONOTONIC in ns
+// both extrapolate over VSYNCs that happened after the snapshot
+
+// field line the beam is on at time t and ns since that line started
+void lp_beam_position(const struct lightpen_vsync *vsync, uint64_t t, uint32_t *line, uint32_t *ns);
+
+// time the beam reaches the start of line next, at t or later
+uint64_t lp_beam_time(const struct lightpen_vsync *vsync, uint64_t t, uint32_t line);
+
+// ------------------ Shared memory page ------------------------------------
+
+// lightgun query ids, same values as RETRO_DEVICE_ID_LIGHTGUN_* in libretro.h
+// so an input driver can pass them through
+enum lp_lightgun_id {
+    LP_LIGHTGUN_TRIGGER = 2,        // 1 while button is pressed
+    LP_LIGHTGUN_SCREEN_X = 13,      // -0x7fff (left edge) to 0x7fff (right edge)
+    LP_LIGHTGUN_SCREEN_Y = 14,      // -0x7fff (top edge) to 0x7fff (bottom edge)
+    LP_LIGHTGUN_IS_OFFSCREEN = 15,  // 1 if pen doesn't see the screen
+};
+
+struct lp_shm {
+    const struct lightpen_shared *page;
+};
+
+// map the driver's shared page, the device is closed right away so others can still open it
+int lp_shm_open(struct lp_shm *shm, const char *device);
+void lp_shm_close(struct lp_shm *shm);
+
+// consistent copy of the shared page, no syscall
+void lp_shm_snapshot(const struct lp_shm *shm, struct lightpen_shared *snap);
+
+// copy the latest sample if it's newer than *last, returns number of records (0 or 1) for lp_iter_init()
+size_t lp_shm_next(const struct lp_shm *shm, uint64_t *last, struct lightpen_record *rec);
+
+// answer libretro-style lightgun query, width/height is the calibrated screen size
+int lp_lightgun_query(const struct lp_shm *shm, enum lp_lightgun_id id, int width, int height);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
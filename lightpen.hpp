@@ -0,0 +1,115 @@
+/***************************************************************************
+
+ liblightpen - C++ wrapper, header only
+
+ Copyright (c) 2020 Maciej Witkowiak
+
+ Licensed under The MIT License (MIT), see rpi_lightpen.c for details
+
+***************************************************************************/
+
+#ifndef _LIGHTPEN_HPP
+#define _LIGHTPEN_HPP
+
+#include <cerrno>
+#include <cstddef>
+#include <system_error>
+
+#include "lightpen.h"
+
+namespace lightpen {
+
+// throw on -errno returned by the C library
+inline int check(int err, const char *what) {
+    if (err < 0)
+        throw std::system_error(-err, std::generic_category(), what);
+    return err;
+}
+
+// records read in one batch, iterate with range-for, points into caller's buffer
+class records {
+public:
+    records(const lightpen_record *begin, std::size_t count) : begin_(begin), end_(begin + count) {}
+    const lightpen_record *begin() const { return begin_; }
+    const lightpen_record *end() const { return end_; }
+    std::size_t size() const { return end_ - begin_; }
+    bool empty() const { return begin_ == end_; }
+private:
+    const lightpen_record *begin_;
+    const lightpen_record *end_;
+};
+
+class device {
+public:
+    explicit device(const char *path = LP_DEVICE, int flags = 0) { check(lp_open(&dev_, path, flags), path); }
+    ~device() { lp_close(&dev_); }
+    device(const device &) = delete;
+    device &operator=(const device &) = delete;
+
+    int fd() const { return lp_fd(&dev_); }
+
+    void set_mode(int mode) { check(lp_set_mode(&dev_, mode), "LIGHTPEN_IOC_SET_MODE"); }
+    void set_calib(const lightpen_calib &calib) { check(lp_set_calib(&dev_, &calib), "LIGHTPEN_IOC_SET_CALIB"); }
+    void set_zones(const lightpen_zones &zones) { check(lp_set_zones(&dev_, &zones), "LIGHTPEN_IOC_SET_ZONES"); }
+    void set_machine(lightpen_machine &machine) { check(lp_set_machine(&dev_, &machine), "LIGHTPEN_IOC_SET_MACHINE"); }
+    void arm_trigger(const lightpen_trigger &trigger) { check(lp_arm_trigger(&dev_, &trigger), "LIGHTPEN_IOC_ARM_TRIGGER"); }
+    void set_watermark(uint32_t watermark) { check(lp_set_watermark(&dev_, watermark), "LIGHTPEN_IOC_SET_WATERMARK"); }
+    void set_timeout(uint32_t ms) { check(lp_set_timeout(&dev_, ms), "LIGHTPEN_IOC_SET_TIMEOUT"); }
+    void set_eventfd(int efd, uint32_t flags) { check(lp_set_eventfd(&dev_, efd, flags), "LIGHTPEN_IOC_SET_EVENTFD"); }
+
+    lightpen_vsync vsync() {
+        lightpen_vsync v;
+        check(lp_get_vsync(&dev_, &v), "LIGHTPEN_IOC_GET_VSYNC");
+        return v;
+    }
+
+    uint32_t frame() {
+        uint32_t f;
+        check(lp_get_frame(&dev_, &f), "LIGHTPEN_IOC_GET_FRAME");
+        return f;
+    }
+
+    // read into buf[0..N), empty result if a non-blocking device has no data
+    template <std::size_t N>
+    records read(lightpen_record (&buf)[N]) {
+        ssize_t n = lp_read_records(&dev_, buf, N);
+        if (n == -EAGAIN)
+            n = 0;
+        check(n, "read");
+        return records(buf, n);
+    }
+
+private:
+    lp_dev dev_;
+};
+
+class shared_page {
+public:
+    explicit shared_page(const char *path = LP_DEVICE) { check(lp_shm_open(&shm_, path), path); }
+    ~shared_page() { lp_shm_close(&shm_); }
+    shared_page(const shared_page &) = delete;
+    shared_page &operator=(const shared_page &) = delete;
+
+    lightpen_shared snapshot() const {
+        lightpen_shared snap;
+        lp_shm_snapshot(&shm_, &snap);
+        return snap;
+    }
+
+    // latest sample if it wasn't seen yet, same iteration as device::read()
+    records next(lightpen_record &rec) { return records(&rec, lp_shm_next(&shm_, &last_, &rec)); }
+
+    int lightgun(lp_lightgun_id id, int width, int height) const { return lp_lightgun_query(&shm_, id, width, height); }
+
+private:
+    lp_shm shm_;
+    uint64_t last_ = 0;
+};
+
+inline void calibrate(const lightpen_calib &calib, int col, int line, int &x, int &y) {
+    lp_calib_apply(&calib, col, line, &x, &y);
+}
+
+}
+
+#endif
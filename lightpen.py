@@ -0,0 +1,87 @@
+import os
+import fcntl
+import select
+import struct
+
+PAL_LINE_LENGTH=64
+LP_DEVICE="/dev/lightpen0"
+
+# ioctl numbers from rpi_lightpen.h
+def _IO(nr):
+    return (ord('L') << 8) | nr
+
+def _IOW(nr, size):
+    return (1 << 30) | (size << 16) | _IO(nr)
+
+LIGHTPEN_IOC_SET_CALIB = _IOW(2, 16)
+LIGHTPEN_IOC_SET_TIMEOUT = _IO(8)
+
+#
+# one open session on the light pen device, samples are never lost between reads
+# (every open starts at the newest sample, so share the session instead of reopening)
+#
+class Session:
+    def __init__(self, device=LP_DEVICE):
+        self.fd = os.open(device, os.O_RDONLY)
+        self.pending = b""
+        self.button = 1
+
+    def close(self):
+        os.close(self.fd)
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    # next (col,line,but) sample, blocking
+    def read(self):
+        while b"\n" not in self.pending:
+            data = os.read(self.fd, 64)
+            if not data:
+                raise EOFError
+            self.pending += data
+        line, self.pending = self.pending.split(b"\n", 1)
+        sample = [ int(x) for x in line.decode().split(",") ]
+        self.button = sample[2]
+        return sample
+
+    # newest sample, older ones still waiting in the driver or our buffer are skipped
+    def latest(self):
+        sample = self.read()
+        while b"\n" in self.pending or select.select([self.fd], [], [], 0)[0]:
+            sample = self.read()
+        return sample
+
+    def __iter__(self):
+        while True:
+            yield self.read()
+
+    # wait for the button to be pressed while pointing at a target, collect up to burst samples
+    # while it is held and return averaged (col,line) after release
+    def collect_target(self, burst=16):
+        samples = []
+        lastbut = self.button
+        while True:
+            (col,line,but) = self.read()
+            if but==0 and (lastbut==1 or samples):
+                if len(samples) < burst:
+                    samples.append((col,line))
+            elif but==1 and samples:
+                break
+            lastbut = but
+        # average columns around the first one, they wrap around at PAL_LINE_LENGTH
+        col0 = samples[0][0]
+        dcol = sum([ (c-col0+PAL_LINE_LENGTH//2) % PAL_LINE_LENGTH - PAL_LINE_LENGTH//2 for (c,l) in samples ])
+        col = int(round(col0 + dcol/len(samples))) % PAL_LINE_LENGTH
+        line = int(round(sum([ l for (c,l) in samples ])/len(samples)))
+        return (col,line)
+
+    # upload 8.8 fixed-point calibration to the driver (screen zones, shared page)
+    def set_calib(self, offsx, offsy, scalex, scaley):
+        fcntl.ioctl(self.fd, LIGHTPEN_IOC_SET_CALIB, struct.pack("iiii", offsx, offsy, scalex, scaley))
+
+    # blocking reads return (-1,-1,-1) after ms milliseconds without a sample, 0 waits forever
+    def set_timeout(self, ms):
+        fcntl.ioctl(self.fd, LIGHTPEN_IOC_SET_TIMEOUT, ms)
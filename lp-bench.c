@@ -0,0 +1,87 @@
+// per-query cost of the shared page against read() on the light pen device
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+
+#include "lightpen.h"
+
+#define SHM_QUERIES  1000000
+#define READ_QUERIES 500                    // one record per field, about 10s
+#define READ_WAIT_MS 1000                   // no record for that long: pen doesn't see the screen
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int main(int argc, char *argv[]) {
+    const char *device = (argc > 1) ? argv[1] : LP_DEVICE;
+    struct lightpen_record rec;
+    struct lp_shm shm;
+    struct lp_dev dev;
+    struct pollfd pfd;
+    uint64_t start, elapsed;
+    volatile int sink = 0;
+    ssize_t n;
+    int i, err;
+
+    err = lp_shm_open(&shm, device);
+    if (err != 0) {
+        fprintf(stderr, "can't map %s: %s\n", device, strerror(-err));
+        return 1;
+    }
+    start = now_ns();
+    for (i = 0; i < SHM_QUERIES; i++) {
+        sink += lp_lightgun_query(&shm, LP_LIGHTGUN_SCREEN_X, 640, 480);
+        sink += lp_lightgun_query(&shm, LP_LIGHTGUN_SCREEN_Y, 640, 480);
+        sink += lp_lightgun_query(&shm, LP_LIGHTGUN_TRIGGER, 640, 480);
+        sink += lp_lightgun_query(&shm, LP_LIGHTGUN_IS_OFFSCREEN, 640, 480);
+    }
+    elapsed = now_ns() - start;
+    lp_shm_close(&shm);
+    printf("mmap:\t%.1f ns per X/Y/trigger/offscreen query\n", (double)elapsed / SHM_QUERIES);
+
+    err = lp_open(&dev, device, O_NONBLOCK);
+    if (err == 0)
+        err = lp_set_mode(&dev, LIGHTPEN_MODE_RECORD);
+    if (err == -EBUSY) {
+        // mode is the pen's, other readers of the device would get records too
+        printf("read():\tskipped, %s is open elsewhere\n", device);
+        lp_close(&dev);
+        return 0;
+    }
+    if (err != 0) {
+        fprintf(stderr, "can't open %s: %s\n", device, strerror(-err));
+        return 1;
+    }
+    // time only the reads that return a record, waiting for one is not the cost of a query
+    pfd.fd = lp_fd(&dev);
+    pfd.events = POLLIN;
+    elapsed = 0;
+    i = 0;
+    while ((i < READ_QUERIES) && (poll(&pfd, 1, READ_WAIT_MS) > 0)) {
+        start = now_ns();
+        n = lp_read_records(&dev, &rec, 1);
+        elapsed += now_ns() - start;
+        if ((n < 0) && (n != -EAGAIN)) {
+            fprintf(stderr, "read: %s\n", strerror(-n));
+            return 1;
+        }
+        if (n > 0)
+            i++;
+    }
+    lp_set_mode(&dev, LIGHTPEN_MODE_COORDS);     // we were the only reader, back to the default
+    lp_close(&dev);
+    if (i == 0)
+        printf("read():\tskipped, no records from %s, point the pen at the screen\n", device);
+    else
+        printf("read():\t%.1f ns per query, %d records\n", (double)elapsed / i, i);
+
+    return 0;
+}
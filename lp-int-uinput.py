@@ -4,10 +4,10 @@ import os
 import random
 import time
 import sys
+import lightpen
 import uinput
 
-PAL_LINE_LENGTH=64
-LP_DEVICE="/dev/lightpen0"
+PAL_LINE_LENGTH=lightpen.PAL_LINE_LENGTH
 
 # screensize
 SCREEN_WIDTH=640
@@ -39,18 +39,11 @@ font_big = pygame.font.Font(None, 48)
 text_surface = font_big.render('Hello', True, WHITE)
 but_surface = font_big.render("Fire!", True, WHITE)
 
-def get_raw_coords():
-    with open(LP_DEVICE) as f:
-        line = f.readline().strip().split(",")
-        return [ int(x) for x in line ]
+# one session for calibration and the main loop
+lp = lightpen.Session()
 
 def get_on_button_release():
-        but = 1
-        while but==1:
-            (col,line,but) = get_raw_coords()
-        while but==0:
-            (col,line,but) = get_raw_coords()
-        return (col,line)
+    return lp.collect_target()
 
 def cal_box_draw(x,y,text):
     rect = (x,y,64,64)
@@ -111,14 +104,12 @@ print("scaling:")
 print("offset\tx = "+str(cal_offsx)+"\t\t y = "+str(cal_offsy))
 print("range\tx = "+str(cal_rangex)+"\t\t y = "+str(cal_rangey))
 print("scale\tx = "+str(cal_scalex)+"\t y = "+str(cal_scaley))
+lp.set_calib(cal_offsx, cal_offsy, cal_scalex, cal_scaley)
 
 lastbut = 1
 with uinput.Device(events) as device:
-  with open(LP_DEVICE) as f:
-    for line in f:
-#        print(line)
-        line = line.strip().split(",")
-        (col,line,but) = [ int(x) for x in line ]
+  with lp:
+    for (col,line,but) in lp:
         # bitshift to go from 8.8 fixed-point to integers
         y = max(min(((line-cal_offsy)*cal_scaley) >> 8, SCREEN_HEIGHT), 0)
 #        x = max(min(((col-cal_offsx)*cal_scalex) >> 8, SCREEN_WIDTH), 0)
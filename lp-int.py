@@ -4,9 +4,9 @@ import os
 import random
 import time
 import sys
+import lightpen
 
-PAL_LINE_LENGTH=64
-LP_DEVICE="/dev/lightpen0"
+PAL_LINE_LENGTH=lightpen.PAL_LINE_LENGTH
 
 # screensize
 SCREEN_WIDTH=640
@@ -29,18 +29,11 @@ font_big = pygame.font.Font(None, 48)
 text_surface = font_big.render('Hello', True, WHITE)
 but_surface = font_big.render("Fire!", True, WHITE)
 
-def get_raw_coords():
-    with open(LP_DEVICE) as f:
-        line = f.readline().strip().split(",")
-        return [ int(x) for x in line ]
+# one session for calibration and the main loop
+lp = lightpen.Session()
 
 def get_on_button_release():
-        but = 1
-        while but==1:
-            (col,line,but) = get_raw_coords()
-        while but==0:
-            (col,line,but) = get_raw_coords()
-        return (col,line)
+    return lp.collect_target()
 
 def cal_box_draw(x,y,text):
     rect = (x,y,64,64)
@@ -100,26 +93,35 @@ print("scaling:")
 print("offset\tx = "+str(cal_offsx)+"\t\t y = "+str(cal_offsy))
 print("range\tx = "+str(cal_rangex)+"\t\t y = "+str(cal_rangey))
 print("scale\tx = "+str(cal_scalex)+"\t y = "+str(cal_scaley))
+lp.set_calib(cal_offsx, cal_offsy, cal_scalex, cal_scaley)
 
+# redraw only where the label was and where it is now, full screen update takes longer than a sample
+lcd.fill(BLACK)
+pygame.display.update()
+last_rect = None
 try:
-  with open(LP_DEVICE) as f:
-     for line in f:
-#        print(line)
-        line = line.strip().split(",")
-        (col,line,but) = [ int(x) for x in line ]
+  with lp:
+     while True:
+        # render the newest sample only, skip the ones that queued up meanwhile
+        (col,line,but) = lp.latest()
         y = ((line-cal_offsy)*cal_scaley) >> 8 # bitshift to go from 8.8 fixed-point to integers
         xoffs = col-cal_offsx
         if (xoffs<0):
             xoffs = xoffs + (PAL_LINE_LENGTH << 8)
         x = (xoffs*cal_scalex) >> 8
 #        print("x="+str(x)+",y="+str(y)+"\tline="+str(line)+",col="+str(col)+"\n")
-        lcd.fill(BLACK)
+        dirty = []
+        if last_rect:
+            lcd.fill(BLACK, last_rect)
+            dirty.append(last_rect)
         if but==1:
             rect = text_surface.get_rect(center=(x,y))
             lcd.blit(text_surface, rect)
         else:
             rect = but_surface.get_rect(center=(x,y))
             lcd.blit(but_surface, rect)
-        pygame.display.update()
+        dirty.append(rect)
+        pygame.display.update(dirty)
+        last_rect = rect
 except:
     pygame.quit()
@@ -0,0 +1,203 @@
+// DRM/KMS vblank as VSYNC source for the light pen driver (insmod ... vsync_source=drm)
+// and period jitter of DRM vblank against the driver's VSYNC
+//
+//  lp-vblank [-d /dev/dri/card0] [-c crtc] [-l /dev/lightpen1]          pass vblank events to the driver
+//  lp-vblank [-d /dev/dri/card0] [-c crtc] [-l /dev/lightpen1] -s secs  compare both sources, nothing is injected
+//
+// works with any KMS driver, vkms included (modprobe vkms), DRM timestamps are CLOCK_MONOTONIC
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include <xf86drm.h>
+
+#include "rpi_lightpen.h"
+
+#define MAX_SAMPLES 8192
+
+struct source {
+    const char *name;
+    uint64_t t[MAX_SAMPLES];    // CLOCK_MONOTONIC ns of every VSYNC
+    int n;
+};
+
+static struct source drm_src = { .name = "drm" };
+static struct source lp_src = { .name = "lightpen" };
+static int lp_fd = -1;
+static int inject = 1;
+static int crtc = 0;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void add_sample(struct source *src, uint64_t t) {
+    if (src->n < MAX_SAMPLES)
+        src->t[src->n++] = t;
+}
+
+// ask for an event on the next vblank of crtc
+static int vblank_request(int fd) {
+    drmVBlank vbl;
+
+    memset(&vbl, 0, sizeof(vbl));
+    vbl.request.type = DRM_VBLANK_RELATIVE | DRM_VBLANK_EVENT;
+    if (crtc > 0)
+        vbl.request.type |= (crtc << DRM_VBLANK_HIGH_CRTC_SHIFT) & DRM_VBLANK_HIGH_CRTC_MASK;
+    vbl.request.sequence = 1;
+    return drmWaitVBlank(fd, &vbl);
+}
+
+static void on_vblank(int fd, unsigned int sequence, unsigned int sec, unsigned int usec, void *data) {
+    uint64_t t = (uint64_t)sec * 1000000000ull + (uint64_t)usec * 1000;
+
+    if (inject) {
+        if ((ioctl(lp_fd, LIGHTPEN_IOC_INJECT_VSYNC, &t) < 0) && (errno != EINVAL))
+            fprintf(stderr, "LIGHTPEN_IOC_INJECT_VSYNC: %s\n", strerror(errno));
+    } else {
+        add_sample(&drm_src, t);
+    }
+    if (vblank_request(fd) != 0)
+        fprintf(stderr, "drmWaitVBlank: %s\n", strerror(errno));
+}
+
+static void report_periods(const struct source *src) {
+    double sum = 0, sq = 0, mean, d;
+    double min = 1e30, max = 0;
+    int i, n = src->n - 1;
+
+    if (n < 2) {
+        printf("%-10s too few VSYNCs (%d)\n", src->name, src->n);
+        return;
+    }
+    for (i = 0; i < n; i++) {
+        d = (double)(src->t[i + 1] - src->t[i]);
+        sum += d;
+        if (d < min)
+            min = d;
+        if (d > max)
+            max = d;
+    }
+    mean = sum / n;
+    for (i = 0; i < n; i++) {
+        d = (double)(src->t[i + 1] - src->t[i]) - mean;
+        sq += d * d;
+    }
+    printf("%-10s %6d periods  mean %10.3f us  stddev %8.3f us  min %10.3f us  max %10.3f us\n",
+           src->name, n, mean / 1000, sqrt(sq / (n - 1)) / 1000, min / 1000, max / 1000);
+}
+
+// light pen VSYNC minus nearest DRM vblank, the value to start vsync_phase_ns with
+static void report_phase(void) {
+    double sum = 0, sq = 0, mean, d, period;
+    int i, j = 0, n = 0;
+    int64_t best, diff;
+
+    if ((drm_src.n < 2) || (lp_src.n < 1))
+        return;
+    period = (double)(drm_src.t[drm_src.n - 1] - drm_src.t[0]) / (drm_src.n - 1);
+    for (i = 0; i < lp_src.n; i++) {
+        while ((j + 1 < drm_src.n) && (drm_src.t[j + 1] <= lp_src.t[i]))
+            j++;
+        best = (int64_t)(lp_src.t[i] - drm_src.t[j]);
+        if (j + 1 < drm_src.n) {
+            diff = (int64_t)(lp_src.t[i] - drm_src.t[j + 1]);
+            if (llabs(diff) < llabs(best))
+                best = diff;
+        }
+        if (llabs(best) > period / 2)
+            continue;
+        sum += best;
+        sq += (double)best * best;
+        n++;
+    }
+    if (n < 2)
+        return;
+    mean = sum / n;
+    d = sq / n - mean * mean;
+    printf("phase      lightpen - drm  mean %10.3f us  stddev %8.3f us\n", mean / 1000, sqrt(d > 0 ? d : 0) / 1000);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-d drm device] [-c crtc] [-l lightpen vsync device] [-s seconds]\n", name);
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    const char *drm_dev = "/dev/dri/card0";
+    const char *lp_dev = "/dev/lightpen1";
+    drmEventContext evctx = { .version = 2, .vblank_handler = on_vblank };
+    struct lightpen_vsync v;
+    struct pollfd fds[2];
+    uint64_t end = 0;
+    int seconds = 0;
+    int drm_fd;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:c:l:s:")) != -1) {
+        switch (opt) {
+            case 'd': drm_dev = optarg; break;
+            case 'c': crtc = atoi(optarg); break;
+            case 'l': lp_dev = optarg; break;
+            case 's': seconds = atoi(optarg); break;
+            default: usage(argv[0]);
+        }
+    }
+    inject = (seconds == 0);
+
+    drm_fd = open(drm_dev, O_RDWR | O_CLOEXEC);
+    if (drm_fd < 0) {
+        fprintf(stderr, "can't open %s: %s\n", drm_dev, strerror(errno));
+        return 1;
+    }
+    lp_fd = open(lp_dev, O_RDONLY | O_NONBLOCK);
+    if (lp_fd < 0) {
+        fprintf(stderr, "can't open %s: %s\n", lp_dev, strerror(errno));
+        return 1;
+    }
+    if (vblank_request(drm_fd) != 0) {
+        fprintf(stderr, "drmWaitVBlank on crtc %d: %s\n", crtc, strerror(errno));
+        return 1;
+    }
+
+    fds[0].fd = drm_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = lp_fd;
+    fds[1].events = POLLIN;
+    if (!inject)
+        end = now_ns() + (uint64_t)seconds * 1000000000ull;
+
+    while (inject || (now_ns() < end)) {
+        // while injecting the driver's VSYNCs are our own, don't watch them
+        if (poll(fds, inject ? 1 : 2, 1000) < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "poll: %s\n", strerror(errno));
+            return 1;
+        }
+        if (fds[0].revents & POLLIN)
+            drmHandleEvent(drm_fd, &evctx);
+        if (!inject && (fds[1].revents & POLLIN)) {
+            while (read(lp_fd, &v, sizeof(v)) == sizeof(v))
+                add_sample(&lp_src, v.timestamp);
+        }
+    }
+
+    report_periods(&drm_src);
+    report_periods(&lp_src);
+    report_phase();
+
+    close(lp_fd);
+    close(drm_fd);
+    return 0;
+}
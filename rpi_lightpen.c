@@ -40,228 +40,2637 @@ SOFTWARE.
 ***************************************************************************/
 
 #include <linux/cdev.h>
+#include <linux/cpumask.h>
+#include <linux/debugfs.h>
+#include <linux/delay.h>
 #include <linux/device.h>
+#include <linux/eventfd.h>
 #include <linux/fs.h>
 #include <linux/gpio.h>
+#include <linux/input.h>
+#include <linux/input/mt.h>
 #include <linux/interrupt.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/list.h>
+#include <linux/math64.h>
+#include <linux/mm.h>
 #include <linux/module.h>
 #include <linux/poll.h>
+#include <linux/sched.h>
+#include <linux/seqlock.h>
+#include <linux/spinlock.h>
+#include <linux/timex.h>
+#include <linux/uaccess.h>
+#include <linux/uio.h>
+#include <linux/vmalloc.h>
 #include <linux/version.h>
 #include <linux/wait.h>
 #include <linux/time.h>
 #include <linux/errno.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0)
+#include <linux/sched/types.h>         // struct sched_param
+#include <linux/sched/task.h>          // get_task_struct()
+#endif
+
+#include "rpi_lightpen.h"
 
 // ------------------ Default values ----------------------------------------
 
 #define GPIO_TS_CLASS_NAME "lightpen"       // device class name
 #define GPIO_TS_ENTRIES_NAME "lightpen%d"   // device name template
-#define GPIO_TS_NB_ENTRIES_MAX 2  // we only need 2 GPIOs
+#define GPIO_TS_STATION_ENTRIES_NAME "lightpen%d.%d"    // same for stations other than the first one
+#define GPIO_TS_PENS_MAX 4                  // light pens sharing one VSYNC
+#define GPIO_TS_NB_ENTRIES_MAX (GPIO_TS_PENS_MAX + 1)   // pens and VSYNC
+#define GPIO_TS_VSYNC_INDEX 1               // gpios=<lp0>,<vsync>[,<lp1>,...]
+#define GPIO_TS_STATIONS_MAX 4              // CRT screens with their own VSYNC
+#define GPIO_TS_MINORS_MAX (GPIO_TS_STATIONS_MAX * GPIO_TS_NB_ENTRIES_MAX)
 
 #define PAL_LINE_LENGTH 64
+#define PAL_LINE_NS (PAL_LINE_LENGTH * 1000)
+#define PAL_FRAME_LINES 625         // two fields, VSYNC comes every 312.5 lines
+#define PAL_FIELD_NS (PAL_FRAME_LINES * PAL_LINE_NS / 2)   // nominal VSYNC period
+
+#define GPIO_TS_OFFSCREEN_FRAMES LIGHTPEN_OFFSCREEN_FRAMES
+
+// sensor edges this soon after the armed frame's VSYNC are from vertical blanking, not the picture
+#define GPIO_TS_TRIG_BLANK_NS (20 * PAL_LINE_NS)
+
+// confidence saturates at this many lines lit and this average pulse width,
+// a single short pulse is most likely noise
+#define GPIO_TS_CONF_LINES 4
+#define GPIO_TS_CONF_PULSE_NS 8000
+// a dark sensor later than this after the rising edge isn't the end of that pulse
+#define GPIO_TS_PULSE_MAX_NS (PAL_LINE_NS / 2)
+
+#define GPIO_TS_RECORDS 64                  // sample history for LIGHTPEN_MODE_RECORD readers, power of 2
+#define GPIO_TS_EVENTS 32                   // zone/trigger events kept for readers, power of 2
+#define GPIO_TS_READ_CHUNK 8                // records copied to userspace at once
+
+#define GPIO_TS_CLOCK_SHIFT 20            // cycles to ns multiplier is 12.20 fixed point
+#define GPIO_TS_CLOCK_MIN_NS (PAL_FIELD_NS / 2)     // closer VSYNCs (other stations) don't take a new reference
+#define GPIO_TS_CLOCK_MAX_NS (NSEC_PER_SEC / 2)     // a 32 bit counter might have wrapped since, keep the multiplier
+#define GPIO_TS_CLOCK_INIT_MS 20                    // first correlation, above GPIO_TS_CLOCK_MIN_NS to be taken
+
+#define GPIO_TS_SCOPE_COLS 256                          // sensor scope image, 250ns per column
+#define GPIO_TS_SCOPE_LINES 313                         // one field, both fields are drawn over each other
+#define GPIO_TS_SCOPE_COL_NS (PAL_LINE_NS / GPIO_TS_SCOPE_COLS)
+#define GPIO_TS_SCOPE_SIZE (GPIO_TS_SCOPE_COLS * GPIO_TS_SCOPE_LINES)
+#define GPIO_TS_SCOPE_PULSE_MAX_NS (4 * PAL_LINE_NS)    // longer pulses are cut
+#define GPIO_TS_SCOPE_FRAMES_MAX 10000
+
+#define GPIO_TS_LEARN_WAIT_NS 100000     // longer GPIO to handler latency doesn't count
+
+#define GPIO_TS_POLL_BLANK_NS (20 * PAL_LINE_NS)        // poll thread sleeps this long after VSYNC
+#define GPIO_TS_POLL_NOSIGNAL_NS 100000000              // no VSYNC for this long, stop spinning
+#define GPIO_TS_POLL_NOSIGNAL_SLEEP_NS 1000000          // and look again this often
 
 // ------------------- Device Info structure --------------------------------
+struct gpio_ts_pen;
+struct gpio_ts_station;
+
 struct gpio_ts_devinfo {
     struct timespec ts;                 // timestamp of most recent event
     long usecs;                         // same, calculated usecs
     wait_queue_head_t waitqueue;        // the waitqueue for poll() support
-    int opencount;                      // to ensure exclusive access to each GPIO device
-    int num;                            // 0=lp, 1=vsync
+    atomic_t opencount;                 // number of open files
+    int num;                            // index into gpios, GPIO_TS_VSYNC_INDEX is vsync
+    struct gpio_ts_station *station;    // CRT station the GPIO belongs to
+    struct gpio_ts_pen *pen;            // light pen state, NULL for vsync
+    u64 irq_ns;                         // raw hard IRQ timestamp, for the IRQ thread
+    u64 learn_ns;                       // ns timestamp of the last edge while learning latency
+    u32 learn_count;                    // edges processed while learning latency
+    int sched_gen;                      // gpio_ts_sched_gen the IRQ thread was set up for
+};
+
+// ------------------- Event queue ------------------------------------------
+
+// events queued for reading in LIGHTPEN_MODE_ZONES and LIGHTPEN_MODE_TRIGGER
+enum gpio_ts_event_type {
+    GPIO_TS_EV_ENTER,           // pen entered zone
+    GPIO_TS_EV_LEAVE,           // pen left zone
+    GPIO_TS_EV_CLICK,           // button pressed inside zone
+    GPIO_TS_EV_HIT,             // sensor saw the armed frame
+    GPIO_TS_EV_MISS,            // sensor didn't see the armed frame
+};
+
+struct gpio_ts_event {
+    u8 type;                    // enum gpio_ts_event_type
+    u16 id;                     // zone id as registered by userspace
+    s16 x, y;                   // raw position of a hit
+    u32 frame;                  // frame number of a hit/miss
+};
+
+// ------------------- Reader structure -------------------------------------
+// one for each open file, any number of readers see every record and event
+struct gpio_ts_reader {
+    struct gpio_ts_devinfo *devinfo;
+    u32 cursor;                         // next record to read, compared with pen->rec_head
+    u32 ev_cursor;                      // next event to read, compared with pen->ev_head
+    u32 watermark;                      // LIGHTPEN_IOC_SET_WATERMARK
+    u32 timeout;                        // blocking read timeout in ms, 0 waits forever
+    struct eventfd_ctx *eventfd;        // LIGHTPEN_IOC_SET_EVENTFD, NULL if none
+    u32 eventfd_flags;                  // LIGHTPEN_EVENTFD_*
+    struct list_head eventfd_node;      // in pen->eventfds, with pen->lock held
+    char message[256];                  // device read message
+};
+
+// trigger mode state machine
+enum gpio_ts_trigger_state {
+    GPIO_TS_TRIG_IDLE,          // sensor interrupt disabled, nothing to do
+    GPIO_TS_TRIG_WAIT_BUTTON,   // waiting for trigger pull, then arm
+    GPIO_TS_TRIG_ARMED,         // waiting for trig_frame to begin
+    GPIO_TS_TRIG_CAPTURE,       // trig_frame is on screen, sensor interrupt enabled
+};
+
+// ------------------- Light pen state structure ----------------------------
+// one for each sensor GPIO, pens don't share anything but the VSYNC tracker of their station
+struct gpio_ts_pen {
+    // ISR side, written on every sensor edge: the most recent sample and the pulses of its run,
+    // on one cacheline (without spinlock debugging), ordered by size so there are no holes
+    spinlock_t lock ____cacheline_aligned_in_smp;  // protects everything in this structure against the ISRs
+    u32 nsoffset;                       // time difference between last LP event and VSYNC
+    u64 lastlp_ns;                      // ns timestamp of last LP event interrupt
+    u64 pulse_start_ns;                 // rising edge of the pulse in progress
+    long lastedge;                      // usec timestamp of the previous rising edge
+    u32 lp_frame;                       // frame number of last LP event
+    int xpos;                           // calculated X coordinate
+    int ypos;                           // calculated Y coordinate
+    int frames_since_hit;               // VSYNCs since the last LP event
+    u32 run_pulse_ns;                   // sum of measured pulse widths of the current run of lines
+    short lp_button;                    // light pen button state (read during LP event)
+    u8 oddeven;                         // marker if frame during LP event was even or odd
+    u8 run_lines;                       // lines lit in a row
+    u8 run_pulses;                      // pulses with measured width
+    bool in_pulse;                      // sensor is lit, waiting for falling edge
+    bool sample_run;                    // current run belongs to the most recent sample
+    u8 confidence;                      // of the most recent sample
+    u8 lines;                           // same
+
+    // most recent sample as seen by readers, written by the ISRs with pen->lock held,
+    // read() takes a consistent copy without the lock
+    seqcount_t sample_seq ____cacheline_aligned_in_smp;
+    struct lightpen_record sample;
+    // sample history, same seqcount, records[(rec_head - 1) % GPIO_TS_RECORDS] is the sample
+    struct lightpen_record records[GPIO_TS_RECORDS];
+    u32 rec_head;                       // samples ever published
+    u32 rec_tail;                       // oldest record still valid
+    u32 rec_frame_head;                 // rec_head at the last VSYNC
+
+    struct gpio_ts_station *station ____cacheline_aligned_in_smp;
+    int index;                          // light pen number within the station, 0 for the first sensor
+    int gpio_sensor;                    // sensor GPIO of this pen
+    int gpio_button;                    // button GPIO of this pen
+    int irq;                            // sensor IRQ
+    struct gpio_ts_devinfo *devinfo;    // device of this pen, for its waitqueue
+    wait_queue_head_t frame_wait;       // woken at VSYNC, for LIGHTPEN_WATERMARK_FRAME readers
+    struct list_head eventfds;          // readers with an eventfd registered
+
+    // read mode and its state
+    int read_mode;                      // written under sample_seq too, text reads take it with the sample
+    struct lightpen_calib calib;
+    struct lightpen_zones zones;
+    int cur_zone;                       // index into zones.zone[] the pen is in, -1 if none
+    short zone_button;                  // button state at previous hit, to detect clicks
+    int trig_state;
+    u32 trig_frame;                     // frame to report on
+    u64 trig_start_ns;                  // VSYNC timestamp of trig_frame
+    u32 trig_delay;                     // frames between trigger pull and the flash frame
+    short trig_button;                  // button state at previous VSYNC, to detect trigger pull
+    bool trig_hit;                      // sensor already reported trig_frame
+    bool sensor_irq_enabled;
+    bool input_active;                  // pen's multi-touch slot holds a contact
+    bool input_touch;                   // button was pressed when the contact was last reported
+    int input_x, input_y;               // position last reported for the contact
+    struct lightpen_machine machine;    // target machine timing for LIGHTPEN_MODE_MACHINE, sample_seq too
+
+    // zone/trigger events, readers follow ev_head with their own cursor
+    seqcount_t ev_seq;                  // written under pen->lock, readers copy without it
+    struct gpio_ts_event events[GPIO_TS_EVENTS];
+    u32 ev_head;                        // events ever queued
+    u32 ev_tail;                        // oldest event still valid
+    u32 ev_frame_head;                  // ev_head at the last VSYNC
+
+    struct lightpen_shared *shared;     // page mapped by userspace, written with lock held
+
+    // sensor scope: how often each column x line of the field was lit, written with lock held
+    u8 *scope;                          // GPIO_TS_SCOPE_SIZE, allocated on first capture
+    u32 scope_frames;                   // frames requested
+    u32 scope_left;                     // frames to go, scope_frames + 1 while waiting for VSYNC
+};
+
+// ------------------- VSYNC tracker ----------------------------------------
+// written only by the VSYNC ISR, the sensor ISRs read single fields without locking,
+// everyone else takes a consistent snapshot with seq
+struct gpio_ts_vsync {
+    seqcount_t seq;
+    u64 lastvsync_ns;                   // timestamp of last vsync interrupt
+    u32 frame_period;                   // measured VSYNC to VSYNC time in nanoseconds
+    u32 frame;                          // VSYNC counter, the frame number in trigger mode
+    int field;                          // odd/even line level at VSYNC
+};
+
+// ------------------- Station structure ------------------------------------
+// one CRT screen: VSYNC and odd/even lines from its LM1881 and the light pens pointed at it
+struct gpio_ts_station {
+    struct gpio_ts_vsync vsync;         // hot in the ISRs, on its own cacheline
+
+    int index ____cacheline_aligned_in_smp;     // station number, 0 for gpios=
+    int minor;                          // minor number of the first device
+    int nb_gpios;                       // sensors and VSYNC
+    int nb_pens;
+    const int *gpios;                   // gpios[GPIO_TS_VSYNC_INDEX] is VSYNC, all others light pen sensors
+    const int *gpio_button;             // button of each light pen in gpios order
+    int gpio_odd_even;
+    int irq_numbers[GPIO_TS_NB_ENTRIES_MAX];
+    struct gpio_ts_devinfo *devtable[GPIO_TS_NB_ENTRIES_MAX];
+    struct gpio_ts_pen *pens[GPIO_TS_PENS_MAX];     // pens[0] is gpios[0], pens[n] is gpios[n+1]
+    struct input_dev *input;            // one multi-touch slot for each pen, NULL if disabled
+    spinlock_t inject_lock;             // serializes LIGHTPEN_IOC_INJECT_VSYNC callers
+    char input_phys[32];
 };
 
 // ------------------irq handler prototype----------------------------------
 
 static irqreturn_t gpio_ts_handler(int irq, void *devt);
+static irqreturn_t gpio_ts_hardirq(int irq, void *devt);
+static irqreturn_t gpio_ts_irq_thread(int irq, void *devt);
+static void gpio_ts_vsync_event(struct gpio_ts_station *station, u64 timestamp);
+static void gpio_ts_event(struct gpio_ts_devinfo *devinfo, u64 timestamp);
 
 //------------------- Module parameters -------------------------------------
 
+// one set of parameters for each station, gpios=, gpio_lp_button= and gpio_odd_even= describe
+// the first one, gpios1=, gpio_lp_button1= and gpio_odd_even1= the second one and so on
+
 // the table with the requested GPIO pin numbers
-static int gpio_ts_table[GPIO_TS_NB_ENTRIES_MAX];
+static int gpio_ts_table[GPIO_TS_STATIONS_MAX][GPIO_TS_NB_ENTRIES_MAX];
 // the number of gpio pins requested
-static int gpio_ts_nb_gpios;
+static int gpio_ts_nb_gpios[GPIO_TS_STATIONS_MAX];
+// the module parameters definition
+module_param_array_named(gpios, gpio_ts_table[0], int, &gpio_ts_nb_gpios[0], 0644);
+module_param_array_named(gpios1, gpio_ts_table[1], int, &gpio_ts_nb_gpios[1], 0644);
+module_param_array_named(gpios2, gpio_ts_table[2], int, &gpio_ts_nb_gpios[2], 0644);
+module_param_array_named(gpios3, gpio_ts_table[3], int, &gpio_ts_nb_gpios[3], 0644);
+// gpio_ts_table[n][1] is vsync, all others are light pen sensors
+
+// button state (read when lightpen sensor has signal), one for each light pen in gpios order
+static int gpio_lp_button[GPIO_TS_STATIONS_MAX][GPIO_TS_PENS_MAX];
+static int gpio_lp_button_nb[GPIO_TS_STATIONS_MAX];
+// odd/even state (to determine if lightpen/vsync info should be processed)
+static int gpio_odd_even[GPIO_TS_STATIONS_MAX];
 // the module parameters definition
-module_param_array_named(gpios, gpio_ts_table, int, &gpio_ts_nb_gpios, 0644);
-// XXX let's fix gpio_ts_table[0] to lp sensor and [1] to vsync
+module_param_array_named(gpio_lp_button, gpio_lp_button[0], int, &gpio_lp_button_nb[0], 0644);
+module_param_array_named(gpio_lp_button1, gpio_lp_button[1], int, &gpio_lp_button_nb[1], 0644);
+module_param_array_named(gpio_lp_button2, gpio_lp_button[2], int, &gpio_lp_button_nb[2], 0644);
+module_param_array_named(gpio_lp_button3, gpio_lp_button[3], int, &gpio_lp_button_nb[3], 0644);
+module_param_named(gpio_odd_even, gpio_odd_even[0], int, 0644);
+module_param_named(gpio_odd_even1, gpio_odd_even[1], int, 0644);
+module_param_named(gpio_odd_even2, gpio_odd_even[2], int, 0644);
+module_param_named(gpio_odd_even3, gpio_odd_even[3], int, 0644);
+
+// sensor interrupts on both edges to measure pulse widths, otherwise rising edges only,
+// confidence then goes by lines lit alone and the sensor scope marks where pulses begin
+static bool gpio_ts_pulse_width = false;
+module_param_named(pulse_width, gpio_ts_pulse_width, bool, 0444);
+
+// multi-touch input device for each station, positions are calibrated screen coordinates
+static bool gpio_ts_input = false;
+static int gpio_ts_input_width = 640;
+static int gpio_ts_input_height = 480;
+module_param_named(input, gpio_ts_input, bool, 0444);
+module_param_named(input_width, gpio_ts_input_width, int, 0444);
+module_param_named(input_height, gpio_ts_input_height, int, 0444);
+
+// where VSYNC comes from: "gpio" is the LM1881 on gpios[1], "drm" are DRM vblank events
+// passed in by lp-vblank through LIGHTPEN_IOC_INJECT_VSYNC, shifted by vsync_phase_ns to
+// match the composite output's actual sync
+static char *gpio_ts_vsync_source = "gpio";
+static int gpio_ts_vsync_phase_ns = 0;
+static bool gpio_ts_vsync_drm = false;
+module_param_named(vsync_source, gpio_ts_vsync_source, charp, 0444);
+module_param_named(vsync_phase_ns, gpio_ts_vsync_phase_ns, int, 0644);
+
+// what the ISRs timestamp edges with: "ktime" is ktime_get_ns(), "cycles" a raw get_cycles() read,
+// converted to ns only when the edge is processed, by a cycles/ns correlation refreshed at every VSYNC
+static char *gpio_ts_timestamp_source = "ktime";
+static bool gpio_ts_cycles = false;
+module_param_named(timestamp_source, gpio_ts_timestamp_source, charp, 0444);
+
+// GPIO to handler latency subtracted from sensor and VSYNC timestamps, set by hand or learned
+// for latency_learn_ms at load time and whenever latency_learn_ms is written
+static int gpio_ts_sensor_latency_ns = 0;
+static int gpio_ts_vsync_latency_ns = 0;
+static unsigned int gpio_ts_latency_learn_ms = 0;
+static bool gpio_ts_learning = false;
+static struct task_struct *gpio_ts_learn_task = NULL;  // last learning thread, under kernel_param_lock
+static bool gpio_ts_learn_busy = false;                 // the thread hasn't published its results yet
+module_param_named(sensor_latency_ns, gpio_ts_sensor_latency_ns, int, 0644);
+module_param_named(vsync_latency_ns, gpio_ts_vsync_latency_ns, int, 0644);
+
+// busy-poll sampling: with poll_cpu set no GPIO interrupts are requested, a kernel thread
+// bound to that CPU spins on the sensor and VSYNC levels during the picture instead
+static int gpio_ts_poll_cpu = -1;
+module_param_named(poll_cpu, gpio_ts_poll_cpu, int, 0444);
+
+// sensor and VSYNC interrupts of all stations go to irq_cpu (-1 leaves them to the system), with
+// irq_threaded the hard handler only takes the timestamp and the rest runs in the IRQ thread
+// scheduled with irq_policy and irq_priority; irq_cpu, irq_policy and irq_priority can be
+// changed at runtime, see IRQ affinity and priority below
+static int gpio_ts_irq_cpu = -1;
+static bool gpio_ts_irq_threaded = false;
+static int gpio_ts_irq_policy = SCHED_FIFO;
+static int gpio_ts_irq_priority = MAX_RT_PRIO / 2;
+static int gpio_ts_sched_gen = 1;       // bumped on every change of irq_policy or irq_priority
+module_param_named(irq_threaded, gpio_ts_irq_threaded, bool, 0444);
+
+// ------------------ Driver private data type ------------------------------
+
+// the stations, stations[0] is gpios=
+static struct gpio_ts_station *stations[GPIO_TS_STATIONS_MAX];
+static int gpio_ts_nb_stations;
+// the device info table of all stations, indexed by minor number
+static struct gpio_ts_devinfo *devtable[GPIO_TS_MINORS_MAX];
+static int gpio_ts_nb_minors;
+// global flag to block irq handler on module unload
+static bool module_unload = false;
+
+// interrupts of all stations requested, changed with kernel_param_lock held
+static bool gpio_ts_irqs_ready = false;
+
+// busy-poll thread, NULL in interrupt mode
+static struct task_struct *gpio_ts_poll_task;
+
+// ------------------ Driver private methods -------------------------------
+
+//
+// open the GPIO device, any number of files can be open
+// each one gets a reader that starts at the newest record and event
+// and store the reader in the private file data
+//
+static int gpio_ts_open(struct inode *ind, struct file *filp) {
+
+    int gpio_index = iminor(ind);
+    struct gpio_ts_devinfo *devinfo = devtable[gpio_index];
+    struct gpio_ts_reader *reader;
+
+    reader = kzalloc(sizeof(struct gpio_ts_reader), GFP_KERNEL);
+    if (reader == NULL)
+        return -ENOMEM;
+    reader->devinfo = devinfo;
+    reader->watermark = 1;
+    if (devinfo->pen != NULL) {
+        reader->cursor = READ_ONCE(devinfo->pen->rec_head);
+        reader->ev_cursor = READ_ONCE(devinfo->pen->ev_head);
+    } else {
+        reader->cursor = READ_ONCE(devinfo->station->vsync.frame);
+    }
+    atomic_inc(&devinfo->opencount);
+    filp->private_data = reader;
+    // read_iter never blocks with IOCB_NOWAIT, io_uring may try it inline
+    filp->f_mode |= FMODE_NOWAIT;
+
+    return 0;
+}
+
+//
+// register or replace (ctx NULL: remove) reader's eventfd, the old one is released
+//
+static void gpio_ts_set_eventfd(struct gpio_ts_reader *reader, struct eventfd_ctx *ctx, u32 flags) {
+    struct gpio_ts_pen *pen = reader->devinfo->pen;
+    struct eventfd_ctx *old;
+    unsigned long irqflags;
+
+    spin_lock_irqsave(&pen->lock, irqflags);
+    old = reader->eventfd;
+    if (old != NULL)
+        list_del(&reader->eventfd_node);
+    reader->eventfd = ctx;
+    reader->eventfd_flags = flags;
+    if (ctx != NULL)
+        list_add_tail(&reader->eventfd_node, &pen->eventfds);
+    spin_unlock_irqrestore(&pen->lock, irqflags);
+
+    if (old != NULL)
+        eventfd_ctx_put(old);
+}
+
+//
+// signal eventfds registered for flag, called with pen->lock held
+//
+static void gpio_ts_eventfd_signal(struct gpio_ts_pen *pen, u32 flag) {
+    struct gpio_ts_reader *reader;
+
+    list_for_each_entry(reader, &pen->eventfds, eventfd_node) {
+        if (reader->eventfd_flags & flag)
+            eventfd_signal(reader->eventfd, 1);
+    }
+}
+
+//
+// close the GPIO device: free the reader from the file private data
+// 
+static int gpio_ts_release(struct inode *ind, struct file *filp) {
+
+    int gpio_index = iminor(ind);
+    struct gpio_ts_reader *reader = filp->private_data;
+
+    if (reader->eventfd != NULL)
+        gpio_ts_set_eventfd(reader, NULL, 0);
+    atomic_dec(&devtable[gpio_index]->opencount);
+    kfree(filp->private_data);
+    filp->private_data = NULL;
+
+    return 0;
+}
+
+//
+// convert raw column/line into screen coordinates, see struct lightpen_calib
+//
+static void gpio_ts_calibrate(const struct lightpen_calib *calib, int col, int line, int *x, int *y) {
+    int xoffs = col - calib->offsx;
+
+    if (xoffs < 0)
+        xoffs += PAL_LINE_LENGTH;
+    *x = (xoffs * calib->scalex) >> 8;
+    *y = ((line - calib->offsy) * calib->scaley) >> 8;
+}
+
+// ------------------ Screen zones -----------------------------------------
+
+//
+// find the zone containing given raw position, -1 if none
+//
+static int gpio_ts_zone_find(struct gpio_ts_pen *pen, int col, int line) {
+    int i;
+    int x = col;
+    int y = line;
+    struct lightpen_zone *z;
+
+    if (pen->zones.flags & LIGHTPEN_ZONES_SCREEN)
+        gpio_ts_calibrate(&pen->calib, col, line, &x, &y);
+
+    for (i = 0; i < pen->zones.count; i++) {
+        z = &pen->zones.zone[i];
+        if (x >= z->x0 && x < z->x1 && y >= z->y0 && y < z->y1)
+            return i;
+    }
+    return -1;
+}
+
+//
+// queue event for all readers, the oldest one is dropped when full, called with pen->lock held
+//
+static void gpio_ts_event_put(struct gpio_ts_pen *pen, const struct gpio_ts_event *ev) {
+    write_seqcount_begin(&pen->ev_seq);
+    pen->events[pen->ev_head & (GPIO_TS_EVENTS - 1)] = *ev;
+    if (pen->ev_head - pen->ev_tail >= GPIO_TS_EVENTS)
+        pen->ev_tail++;
+    WRITE_ONCE(pen->ev_head, pen->ev_head + 1);
+    write_seqcount_end(&pen->ev_seq);
+}
+
+static void gpio_ts_zone_queue(struct gpio_ts_pen *pen, int type, int zone) {
+    struct gpio_ts_event ev = { .type = type, .id = pen->zones.zone[zone].id };
+
+    gpio_ts_event_put(pen, &ev);
+}
+
+//
+// track pen movement between zones, called with pen->lock held
+// returns true if any event was queued
+//
+static bool gpio_ts_zone_update(struct gpio_ts_pen *pen) {
+    int zone = gpio_ts_zone_find(pen, pen->xpos, pen->ypos);
+    bool queued = false;
+
+    if (zone != pen->cur_zone) {
+        if (pen->cur_zone >= 0)
+            gpio_ts_zone_queue(pen, GPIO_TS_EV_LEAVE, pen->cur_zone);
+        if (zone >= 0)
+            gpio_ts_zone_queue(pen, GPIO_TS_EV_ENTER, zone);
+        pen->cur_zone = zone;
+        queued = true;
+    }
+    if ((zone >= 0) && (pen->lp_button == 0) && (pen->zone_button != 0)) {
+        gpio_ts_zone_queue(pen, GPIO_TS_EV_CLICK, zone);
+        queued = true;
+    }
+    pen->zone_button = pen->lp_button;
+    return queued;
+}
+
+//
+// pen went off-screen, called with pen->lock held
+//
+static bool gpio_ts_zone_leave(struct gpio_ts_pen *pen) {
+    if (pen->cur_zone < 0)
+        return false;
+    gpio_ts_zone_queue(pen, GPIO_TS_EV_LEAVE, pen->cur_zone);
+    pen->cur_zone = -1;
+    pen->zone_button = 1;
+    return true;
+}
+
+// ------------------ Trigger mode -----------------------------------------
+
+//
+// sensor interrupt is needed only during the armed frame in trigger mode,
+// the poll thread skips the sensor instead, called with pen->lock held
+//
+static void gpio_ts_sensor_irq(struct gpio_ts_pen *pen, bool enable) {
+    if (enable == pen->sensor_irq_enabled)
+        return;
+    // poll_cpu is fixed at load, unlike gpio_ts_poll_task it's set before any device node exists
+    if (gpio_ts_poll_cpu < 0) {
+        if (enable)
+            enable_irq(pen->irq);
+        else
+            disable_irq_nosync(pen->irq);
+    }
+    pen->in_pulse = false;      // falling edge won't be seen
+    WRITE_ONCE(pen->sensor_irq_enabled, enable);
+}
+
+//
+// sensor saw the beam during the armed frame, only the first hit counts
+// an edge seen while the interrupt was disabled is replayed by enable_irq() right after
+// the VSYNC that armed capture, its timestamp falls into vertical blanking and is ignored
+// called with pen->lock held, returns true if an event was queued
+//
+static bool gpio_ts_trigger_hit(struct gpio_ts_pen *pen, u64 timestamp) {
+    struct gpio_ts_event ev = { .type = GPIO_TS_EV_HIT, .x = pen->xpos, .y = pen->ypos, .frame = pen->trig_frame };
+
+    if ((pen->trig_state != GPIO_TS_TRIG_CAPTURE) || pen->trig_hit)
+        return false;
+    if ((s64)(timestamp - pen->trig_start_ns) < GPIO_TS_TRIG_BLANK_NS)
+        return false;
+    pen->trig_hit = true;
+    gpio_ts_sensor_irq(pen, false);
+    gpio_ts_event_put(pen, &ev);
+    return true;
+}
+
+//
+// advance trigger state machine on VSYNC, frame has already been incremented
+// called with pen->lock held, returns true if an event was queued
+//
+static bool gpio_ts_trigger_vsync(struct gpio_ts_pen *pen, u32 frame) {
+    struct gpio_ts_event ev = { .type = GPIO_TS_EV_MISS };
+    bool queued = false;
+    short button;
+
+    // armed frame has just ended
+    if (pen->trig_state == GPIO_TS_TRIG_CAPTURE) {
+        if (!pen->trig_hit) {
+            ev.frame = pen->trig_frame;
+            gpio_ts_event_put(pen, &ev);
+            queued = true;
+        }
+        gpio_ts_sensor_irq(pen, false);
+        pen->trig_state = GPIO_TS_TRIG_IDLE;
+    }
+
+    if (pen->trig_state == GPIO_TS_TRIG_WAIT_BUTTON) {
+        button = gpio_get_value(pen->gpio_button);
+        if ((button == 0) && (pen->trig_button != 0)) {
+            pen->trig_frame = frame + pen->trig_delay;
+            pen->trig_state = GPIO_TS_TRIG_ARMED;
+        }
+        pen->trig_button = button;
+    }
+
+    if (pen->trig_state == GPIO_TS_TRIG_ARMED) {
+        if (pen->trig_frame == frame) {
+            pen->trig_hit = false;
+            pen->trig_start_ns = pen->station->vsync.lastvsync_ns;
+            pen->trig_state = GPIO_TS_TRIG_CAPTURE;
+            gpio_ts_sensor_irq(pen, true);
+        } else if ((s32)(pen->trig_frame - frame) < 0) {
+            // announced too late, that frame is already gone
+            ev.frame = pen->trig_frame;
+            gpio_ts_event_put(pen, &ev);
+            pen->trig_state = GPIO_TS_TRIG_IDLE;
+            queued = true;
+        }
+    }
+
+    return queued;
+}
+
+//
+// forget pending data, zone and trigger state, called with pen->lock held
+//
+static void gpio_ts_reset_state(struct gpio_ts_pen *pen) {
+    write_seqcount_begin(&pen->sample_seq);
+    pen->rec_tail = pen->rec_head;
+    write_seqcount_end(&pen->sample_seq);
+    write_seqcount_begin(&pen->ev_seq);
+    pen->ev_tail = pen->ev_head;
+    write_seqcount_end(&pen->ev_seq);
+    pen->cur_zone = -1;
+    pen->zone_button = 1;
+    pen->trig_state = GPIO_TS_TRIG_IDLE;
+    pen->trig_button = 1;
+    gpio_ts_sensor_irq(pen, pen->read_mode != LIGHTPEN_MODE_TRIGGER);
+}
+
+// zone and trigger modes read from the event queue, others the most recent sample
+static bool gpio_ts_event_mode(struct gpio_ts_pen *pen) {
+    return (pen->read_mode == LIGHTPEN_MODE_ZONES) || (pen->read_mode == LIGHTPEN_MODE_TRIGGER);
+}
+
+//
+// entries between cursor and head that are still in the ring
+//
+static u32 gpio_ts_pending(u32 head, u32 tail, u32 cursor, u32 size) {
+    if ((s32)(tail - cursor) > 0)
+        cursor = tail;
+    if ((s32)(head - cursor) <= 0)
+        return 0;
+    return min(head - cursor, size);
+}
+
+//
+// is there enough for this reader, by its watermark
+//
+static bool gpio_ts_data_ready(struct gpio_ts_reader *reader) {
+    struct gpio_ts_pen *pen = reader->devinfo->pen;
+    bool frame = (reader->watermark == LIGHTPEN_WATERMARK_FRAME);
+    u32 pending;
+
+    if (gpio_ts_event_mode(pen))
+        pending = gpio_ts_pending(READ_ONCE(frame ? pen->ev_frame_head : pen->ev_head), READ_ONCE(pen->ev_tail), reader->ev_cursor, GPIO_TS_EVENTS);
+    else
+        pending = gpio_ts_pending(READ_ONCE(frame ? pen->rec_frame_head : pen->rec_head), READ_ONCE(pen->rec_tail), reader->cursor, GPIO_TS_RECORDS);
+
+    return pending >= (frame ? 1 : reader->watermark);
+}
+
+// readers with LIGHTPEN_WATERMARK_FRAME are woken only at VSYNC
+static wait_queue_head_t *gpio_ts_waitqueue(struct gpio_ts_reader *reader) {
+    if (reader->watermark == LIGHTPEN_WATERMARK_FRAME)
+        return &reader->devinfo->pen->frame_wait;
+    return &reader->devinfo->waitqueue;
+}
+
+// ------------------ Target machine coordinates ----------------------------
+
+static const struct lightpen_machine gpio_ts_machines[] = {
+    [LIGHTPEN_MACHINE_RAW]       = { .lines = 312, .cycles = PAL_LINE_LENGTH, .units = 1, .yshift = 0 },
+    [LIGHTPEN_MACHINE_C64_PAL]   = { .lines = 312, .cycles = 63, .units = 4, .yshift = 0 },
+    [LIGHTPEN_MACHINE_ATARI_PAL] = { .lines = 312, .cycles = 114, .units = 1, .yshift = 1 },
+};
+
+//
+// fill in preset timing and check if it makes sense
+//
+static int gpio_ts_machine_setup(struct lightpen_machine *m) {
+    u32 id = m->id;
+    s32 xoffset = m->xoffset;
+    s32 yoffset = m->yoffset;
+
+    if (id < ARRAY_SIZE(gpio_ts_machines)) {
+        *m = gpio_ts_machines[id];
+        m->id = id;
+        m->xoffset = xoffset;
+        m->yoffset = yoffset;
+    } else if (m->id != LIGHTPEN_MACHINE_CUSTOM) {
+        return -EINVAL;
+    }
+    // zero would divide by zero in gpio_ts_machine_coords(), the upper limits keep its int math from overflowing
+    if ((m->lines == 0) || (m->lines > 1024) || (m->cycles == 0) || (m->cycles > 1024))
+        return -EINVAL;
+    if ((m->units == 0) || (m->units > 256) || (m->yshift > 15))
+        return -EINVAL;
+    if ((m->xoffset < -65536) || (m->xoffset > 65536) || (m->yoffset < -65536) || (m->yoffset > 65536))
+        return -EINVAL;
+    return 0;
+}
+
+//
+// convert nanosecond offset from VSYNC into beam position of the target machine
+// the PAL line is the time base, so there is no drift over the frame
+//
+static void gpio_ts_machine_coords(const struct lightpen_machine *m, u32 offset, int *x, int *y) {
+    u32 line = offset / PAL_LINE_NS;
+    u32 cycle = (offset - line * PAL_LINE_NS) * m->cycles / PAL_LINE_NS;
+    int mx = ((int)cycle + m->xoffset) % (int)m->cycles;
+    int my = ((int)line + m->yoffset) % (int)m->lines;
+
+    if (mx < 0)
+        mx += m->cycles;
+    if (my < 0)
+        my += m->lines;
+    *x = mx * m->units;
+    *y = my >> m->yshift;
+}
+
+//
+// format as many events after reader's cursor as fit into message and length
+//
+static ssize_t gpio_ts_format_events(struct gpio_ts_reader *reader, size_t length) {
+    static const char * const names[] = { "enter", "leave", "click", "hit", "miss" };
+    struct gpio_ts_pen *pen = reader->devinfo->pen;
+    struct gpio_ts_event evs[GPIO_TS_EVENTS];
+    const struct gpio_ts_event *ev;
+    char *message = reader->message;
+    ssize_t lg = 0;
+    unsigned int seq;
+    u32 cursor;
+    int count, i, n;
+
+    // copy pending events without pen->lock, retried if the ISR queued one meanwhile
+    do {
+        seq = read_seqcount_begin(&pen->ev_seq);
+        count = gpio_ts_pending(pen->ev_head, pen->ev_tail, reader->ev_cursor, GPIO_TS_EVENTS);
+        cursor = pen->ev_head - count;
+        for (i = 0; i < count; i++)
+            evs[i] = pen->events[(cursor + i) & (GPIO_TS_EVENTS - 1)];
+    } while (read_seqcount_retry(&pen->ev_seq, seq));
+
+    for (i = 0; i < count; i++) {
+        ev = &evs[i];
+        switch (ev->type) {
+            case GPIO_TS_EV_HIT:
+                n = snprintf(message + lg, sizeof(reader->message) - lg, "%s,%u,%i,%i\n", names[ev->type], ev->frame, ev->x, ev->y);
+                break;
+            case GPIO_TS_EV_MISS:
+                n = snprintf(message + lg, sizeof(reader->message) - lg, "%s,%u\n", names[ev->type], ev->frame);
+                break;
+            default:
+                n = snprintf(message + lg, sizeof(reader->message) - lg, "%s,%u\n", names[ev->type], ev->id);
+                break;
+        }
+        if ((lg + n >= sizeof(reader->message)) || (lg + n > length))
+            break;
+        lg += n;
+    }
+    reader->ev_cursor = cursor + i;
+
+    return lg;
+}
+
+// ------------------ Shared memory page -----------------------------------
+
+static void gpio_ts_shared_begin(struct lightpen_shared *shared) {
+    WRITE_ONCE(shared->seq, shared->seq + 1);
+    smp_wmb();
+}
+
+static void gpio_ts_shared_end(struct lightpen_shared *shared) {
+    smp_wmb();
+    WRITE_ONCE(shared->seq, shared->seq + 1);
+}
+
+//
+// publish most recent sample to readers, new_sample adds it to the history,
+// otherwise it replaces the newest record (confidence update), called with pen->lock held
+//
+static void gpio_ts_publish(struct gpio_ts_pen *pen, bool new_sample) {
+    struct lightpen_record *rec = &pen->sample;
+    u32 frame_period = READ_ONCE(pen->station->vsync.frame_period);
+
+    write_seqcount_begin(&pen->sample_seq);
+    rec->timestamp = pen->lastlp_ns;
+    rec->offset = pen->nsoffset;
+    rec->frame_period = frame_period;
+    rec->line_period = frame_period * 2 / PAL_FRAME_LINES;
+    rec->frame = pen->lp_frame;
+    rec->x = pen->xpos;
+    rec->y = pen->ypos;
+    rec->button = pen->lp_button;
+    rec->field = pen->oddeven;
+    rec->confidence = pen->confidence;
+    rec->lines = pen->lines;
+    if (new_sample)
+        pen->rec_head++;
+    pen->records[(pen->rec_head - 1) & (GPIO_TS_RECORDS - 1)] = *rec;
+    write_seqcount_end(&pen->sample_seq);
+}
+
+//
+// copy up to count records after reader's cursor, no lock, retried if the ISR wrote meanwhile
+//
+static int gpio_ts_records(struct gpio_ts_reader *reader, struct lightpen_record *buf, int count) {
+    struct gpio_ts_pen *pen = reader->devinfo->pen;
+    unsigned int seq;
+    u32 cursor;
+    int i, n;
+
+    do {
+        seq = read_seqcount_begin(&pen->sample_seq);
+        n = gpio_ts_pending(pen->rec_head, pen->rec_tail, reader->cursor, GPIO_TS_RECORDS);
+        cursor = pen->rec_head - n;
+        n = min(n, count);
+        for (i = 0; i < n; i++)
+            buf[i] = pen->records[(cursor + i) & (GPIO_TS_RECORDS - 1)];
+    } while (read_seqcount_retry(&pen->sample_seq, seq));
+    reader->cursor = cursor + n;
+
+    return n;
+}
+
+//
+// consistent copy of the most recent sample with the read mode it goes with, and of the target
+// machine timing in machine mode; never waits for pen->lock; returns rec_head that goes with the sample
+//
+static u32 gpio_ts_sample(struct gpio_ts_pen *pen, struct lightpen_record *rec, int *mode, struct lightpen_machine *m) {
+    unsigned int seq;
+    u32 head;
+
+    do {
+        seq = read_seqcount_begin(&pen->sample_seq);
+        *rec = pen->sample;
+        *mode = pen->read_mode;
+        if (*mode == LIGHTPEN_MODE_MACHINE)
+            *m = pen->machine;
+        head = pen->rec_head;
+    } while (read_seqcount_retry(&pen->sample_seq, seq));
+    return head;
+}
+
+//
+// publish new sample to the shared page, called with pen->lock held
+//
+static void gpio_ts_shared_hit(struct gpio_ts_pen *pen) {
+    struct lightpen_shared *shared = pen->shared;
+    int x, y;
+
+    gpio_ts_calibrate(&pen->calib, pen->xpos, pen->ypos, &x, &y);
+    gpio_ts_shared_begin(shared);
+    shared->sample = pen->sample;
+    shared->x = x;
+    shared->y = y;
+    shared->offscreen = 0;
+    gpio_ts_shared_end(shared);
+}
+
+//
+// VSYNC tracker in userspace format, caller makes sure it doesn't change meanwhile
+//
+static void gpio_ts_vsync_fill(const struct gpio_ts_vsync *vsync, struct lightpen_vsync *out) {
+    memset(out, 0, sizeof(*out));
+    out->timestamp = vsync->lastvsync_ns;
+    out->frame_period = vsync->frame_period;
+    out->line_period = vsync->frame_period * 2 / PAL_FRAME_LINES;
+    out->frame = vsync->frame;
+    out->field = vsync->field;
+}
+
+//
+// consistent copy of the VSYNC tracker outside of the VSYNC ISR
+//
+static void gpio_ts_vsync_snapshot(struct gpio_ts_station *station, struct lightpen_vsync *out) {
+    unsigned int seq;
+
+    do {
+        seq = read_seqcount_begin(&station->vsync.seq);
+        gpio_ts_vsync_fill(&station->vsync, out);
+    } while (read_seqcount_retry(&station->vsync.seq, seq));
+}
+
+//
+// publish frame number, button, off-screen state and VSYNC tracker,
+// called from the VSYNC ISR with pen->lock held
+//
+static void gpio_ts_shared_vsync(struct gpio_ts_pen *pen, u32 frame) {
+    struct lightpen_shared *shared = pen->shared;
+
+    gpio_ts_shared_begin(shared);
+    shared->sample.confidence = pen->confidence;
+    shared->sample.lines = pen->lines;
+    shared->frame = frame;
+    gpio_ts_vsync_fill(&pen->station->vsync, &shared->vsync);
+    shared->button = gpio_get_value(pen->gpio_button);
+    shared->offscreen = (pen->frames_since_hit >= GPIO_TS_OFFSCREEN_FRAMES);
+    gpio_ts_shared_end(shared);
+}
+
+// ------------------ VSYNC source -----------------------------------------
+
+//
+// odd/even field, from the LM1881 if wired, otherwise alternating on every VSYNC
+//
+static int gpio_ts_field(struct gpio_ts_station *station) {
+    if (station->gpio_odd_even < 0)
+        return READ_ONCE(station->vsync.field);
+    return gpio_get_value(station->gpio_odd_even);
+}
+
+//
+// VSYNC from DRM vblank, timestamp is CLOCK_MONOTONIC in ns
+// runs the same code as the VSYNC interrupt would, with interrupts disabled
+//
+static int gpio_ts_vsync_inject(struct gpio_ts_station *station, u64 timestamp) {
+    unsigned long flags;
+    int err = 0;
+
+    if (!gpio_ts_vsync_drm)
+        return -EPERM;
+    timestamp += gpio_ts_vsync_phase_ns;
+
+    spin_lock_irqsave(&station->inject_lock, flags);
+    if (timestamp <= station->vsync.lastvsync_ns)
+        err = -EINVAL;          // not monotonic
+    else
+        gpio_ts_vsync_event(station, timestamp);
+    spin_unlock_irqrestore(&station->inject_lock, flags);
+
+    return err;
+}
+
+//
+// vsync device: struct lightpen_vsync after every VSYNC, missed ones are skipped (see frame)
+//
+static bool gpio_ts_vsync_ready(struct gpio_ts_reader *reader) {
+    return READ_ONCE(reader->devinfo->station->vsync.frame) != reader->cursor;
+}
+
+static ssize_t gpio_ts_vsync_read(struct gpio_ts_reader *reader, struct file *filp, bool nowait, struct iov_iter *to) {
+    struct gpio_ts_devinfo *devinfo = reader->devinfo;
+    struct lightpen_vsync v;
+    int err;
+
+    if (iov_iter_count(to) < sizeof(v))
+        return -EINVAL;
+    if (!gpio_ts_vsync_ready(reader)) {
+        if (nowait)
+            return -EAGAIN;
+        err = wait_event_interruptible(devinfo->waitqueue, gpio_ts_vsync_ready(reader));
+        if (err != 0)
+            return err;
+    }
+    gpio_ts_vsync_snapshot(devinfo->station, &v);
+    reader->cursor = v.frame;
+    if (copy_to_iter(&v, sizeof(v), to) != sizeof(v))
+        return -EFAULT;
+    return sizeof(v);
+}
+
+// ------------------ Device operations -----------------------------------
+
+//
+// blocking read timed out, tell the reader explicitly instead of returning nothing
+//
+static ssize_t gpio_ts_read_nodata(struct gpio_ts_reader *reader, struct iov_iter *to) {
+    struct gpio_ts_pen *pen = reader->devinfo->pen;
+    size_t length = iov_iter_count(to);
+    struct lightpen_record rec;
+    ssize_t lg;
+
+    if (pen->read_mode == LIGHTPEN_MODE_RECORD) {
+        if (length < sizeof(rec))
+            return -EINVAL;
+        memset(&rec, 0, sizeof(rec));
+        rec.timestamp = ktime_get_ns();
+        rec.frame = READ_ONCE(pen->station->vsync.frame);
+        rec.x = -1;
+        rec.y = -1;
+        rec.field = LIGHTPEN_FIELD_NODATA;
+        if (copy_to_iter(&rec, sizeof(rec), to) != sizeof(rec))
+            return -EFAULT;
+        return sizeof(rec);
+    }
+
+    if (gpio_ts_event_mode(pen))
+        sprintf(reader->message, "timeout\n");
+    else
+        sprintf(reader->message, "-1,-1,-1\n");
+    lg = strlen(reader->message);
+    if (length < lg)
+        return -EINVAL;
+    if (copy_to_iter(reader->message, lg, to) != lg)
+        return -EFAULT;
+    return lg;
+}
+
+//
+// read records/events after this file's cursor, if any
+// IOCB_NOWAIT (io_uring) is handled like O_NONBLOCK, poll() tells when to retry
+//
+static ssize_t gpio_ts_read_iter(struct kiocb *iocb, struct iov_iter *to) {
+    struct file *filp = iocb->ki_filp;
+    struct gpio_ts_reader *reader = filp->private_data;
+    size_t length = iov_iter_count(to);
+    struct gpio_ts_pen *pen = reader->devinfo->pen;
+    struct lightpen_record recs[GPIO_TS_READ_CHUNK];
+    struct lightpen_machine m;
+    struct lightpen_record rec;
+    size_t count;
+    ssize_t lg;
+    long remain;
+    int err;
+    int mode;
+    int n;
+    int x, y;
+
+    // vsync device reports VSYNCs
+    if (pen == NULL)
+        return gpio_ts_vsync_read(reader, filp, (filp->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT), to);
+
+    // do we have any data?
+    if (!gpio_ts_data_ready(reader)) {
+        // non-blocking read return now
+        if ((filp->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT))
+            return -EAGAIN;
+        // blocking read has to wait, signals interrupt it
+        if (reader->timeout == 0) {
+            err = wait_event_interruptible(*gpio_ts_waitqueue(reader), gpio_ts_data_ready(reader));
+            if (err != 0)
+                return err;
+        } else {
+            remain = wait_event_interruptible_timeout(*gpio_ts_waitqueue(reader), gpio_ts_data_ready(reader), msecs_to_jiffies(reader->timeout));
+            if (remain < 0)
+                return remain;
+            if (remain == 0)
+                return gpio_ts_read_nodata(reader, to);
+        }
+    }
+
+    // as many records as fit, oldest first
+    if (pen->read_mode == LIGHTPEN_MODE_RECORD) {
+        count = length / sizeof(struct lightpen_record);
+        if (count == 0)
+            return -EINVAL;
+        lg = 0;
+        while (count > 0) {
+            n = gpio_ts_records(reader, recs, min_t(size_t, count, GPIO_TS_READ_CHUNK));
+            if (n == 0)
+                break;
+            if (copy_to_iter(recs, n * sizeof(struct lightpen_record), to) != n * sizeof(struct lightpen_record))
+                return -EFAULT;
+            lg += n * sizeof(struct lightpen_record);
+            count -= n;
+        }
+        return lg;
+    }
+
+    if (gpio_ts_event_mode(pen)) {
+        lg = gpio_ts_format_events(reader, length);
+        if (lg == 0)
+            return -EINVAL;     // buffer too small for a single event
+    } else {
+        // text modes report only the most recent sample
+        reader->cursor = gpio_ts_sample(pen, &rec, &mode, &m);
+        if (mode == LIGHTPEN_MODE_MACHINE) {
+            gpio_ts_machine_coords(&m, rec.offset, &x, &y);
+            sprintf(reader->message, "%i,%i,%i\n", x, y, rec.button);
+        } else {
+//          sprintf(message, "%i,%i,%i,%i,%ld,%ld,%ld\n", xpos, ypos, lp_button, oddeven, lastvsync, lastlp, usecoffset);
+            sprintf(reader->message, "%i,%i,%i\n", rec.x, rec.y, rec.button);
+        }
+        lg = strlen(reader->message);
+    }
+
+    if (copy_to_iter(reader->message, lg, to) != lg)
+        return -EFAULT;
+    return lg;
+}
+
+//
+// poll support: called when the user calls poll() on an open GPIO file, or when woken up
+// by the kernel following a waitqueue wake_up by the ISR
+// readiness is per file, this file's cursor against the pen's records/events
+//
+static unsigned int gpio_ts_poll(struct file *filp, struct poll_table_struct *polltable) {
+
+    struct gpio_ts_reader *reader = filp->private_data;
+
+    // vsync device is readable after every VSYNC
+    if (reader->devinfo->pen == NULL) {
+        poll_wait(filp, &reader->devinfo->waitqueue, polltable);
+        return gpio_ts_vsync_ready(reader) ? (POLLPRI | POLLIN) : 0;
+    }
+
+    // put our wait queue in the kernel poll table first, so no wake-up is lost
+    // between the check below and going to sleep
+    poll_wait(filp, gpio_ts_waitqueue(reader), polltable);
+
+    // we have data, return the appropriate mask
+    if (gpio_ts_data_ready(reader))
+        return POLLPRI | POLLIN;
+
+    // return a zero mask so that we'll be put to sleep waiting on the waitqueue
+    return 0;
+}
+
+//
+// ioctl support: read mode, calibration, screen zones and trigger, only on light pen devices
+//
+static long gpio_ts_ioctl(struct file *filp, unsigned int cmd, unsigned long arg) {
+
+    struct gpio_ts_reader *reader = filp->private_data;
+    struct gpio_ts_pen *pen = reader->devinfo->pen;
+    struct lightpen_calib newcalib;
+    struct lightpen_zones *newzones;
+    struct lightpen_trigger trigger;
+    struct lightpen_machine newmachine;
+    struct lightpen_eventfd newevfd;
+    struct lightpen_vsync curvsync;
+    struct eventfd_ctx *ctx;
+    unsigned long flags;
+    u32 curframe;
+    u64 timestamp;
+    int mode;
+    int err;
+
+    // vsync device knows only its tracker
+    if (pen == NULL) {
+        switch (cmd) {
+            case LIGHTPEN_IOC_GET_VSYNC:
+                gpio_ts_vsync_snapshot(reader->devinfo->station, &curvsync);
+                if (copy_to_user((void __user *)arg, &curvsync, sizeof(curvsync)))
+                    return -EFAULT;
+                return 0;
+
+            case LIGHTPEN_IOC_INJECT_VSYNC:
+                if (copy_from_user(&timestamp, (void __user *)arg, sizeof(timestamp)))
+                    return -EFAULT;
+                return gpio_ts_vsync_inject(reader->devinfo->station, timestamp);
+
+            default:
+                return -ENOTTY;
+        }
+    }
+
+    switch (cmd) {
+        case LIGHTPEN_IOC_SET_MODE:
+            mode = (int)arg;
+            if ((mode < LIGHTPEN_MODE_COORDS) || (mode > LIGHTPEN_MODE_RECORD))
+                return -EINVAL;
+            spin_lock_irqsave(&pen->lock, flags);
+            if (mode == pen->read_mode) {
+                spin_unlock_irqrestore(&pen->lock, flags);
+                return 0;
+            }
+            // mode belongs to the pen, don't change the format and drop pending data under other readers
+            if (atomic_read(&reader->devinfo->opencount) > 1) {
+                spin_unlock_irqrestore(&pen->lock, flags);
+                return -EBUSY;
+            }
+            write_seqcount_begin(&pen->sample_seq);
+            pen->read_mode = mode;
+            write_seqcount_end(&pen->sample_seq);
+            gpio_ts_reset_state(pen);
+            spin_unlock_irqrestore(&pen->lock, flags);
+            return 0;
+
+        case LIGHTPEN_IOC_SET_CALIB:
+            if (copy_from_user(&newcalib, (void __user *)arg, sizeof(newcalib)))
+                return -EFAULT;
+            spin_lock_irqsave(&pen->lock, flags);
+            pen->calib = newcalib;
+            spin_unlock_irqrestore(&pen->lock, flags);
+            return 0;
+
+        case LIGHTPEN_IOC_SET_ZONES:
+            newzones = memdup_user((void __user *)arg, sizeof(*newzones));
+            if (IS_ERR(newzones))
+                return PTR_ERR(newzones);
+            if (newzones->count > LIGHTPEN_MAX_ZONES) {
+                kfree(newzones);
+                return -EINVAL;
+            }
+            spin_lock_irqsave(&pen->lock, flags);
+            pen->zones = *newzones;
+            gpio_ts_reset_state(pen);
+            spin_unlock_irqrestore(&pen->lock, flags);
+            kfree(newzones);
+            return 0;
+
+        case LIGHTPEN_IOC_ARM_TRIGGER:
+            if (copy_from_user(&trigger, (void __user *)arg, sizeof(trigger)))
+                return -EFAULT;
+            spin_lock_irqsave(&pen->lock, flags);
+            if (pen->read_mode != LIGHTPEN_MODE_TRIGGER) {
+                spin_unlock_irqrestore(&pen->lock, flags);
+                return -EINVAL;
+            }
+            if (trigger.flags & LIGHTPEN_TRIGGER_BUTTON) {
+                pen->trig_delay = trigger.delay;
+                pen->trig_button = gpio_get_value(pen->gpio_button);
+                pen->trig_state = GPIO_TS_TRIG_WAIT_BUTTON;
+            } else {
+                pen->trig_frame = trigger.frame;
+                pen->trig_state = GPIO_TS_TRIG_ARMED;
+            }
+            gpio_ts_sensor_irq(pen, false);
+            spin_unlock_irqrestore(&pen->lock, flags);
+            return 0;
+
+        case LIGHTPEN_IOC_SET_MACHINE:
+            if (copy_from_user(&newmachine, (void __user *)arg, sizeof(newmachine)))
+                return -EFAULT;
+            err = gpio_ts_machine_setup(&newmachine);
+            if (err != 0)
+                return err;
+            spin_lock_irqsave(&pen->lock, flags);
+            write_seqcount_begin(&pen->sample_seq);
+            pen->machine = newmachine;
+            write_seqcount_end(&pen->sample_seq);
+            spin_unlock_irqrestore(&pen->lock, flags);
+            if (copy_to_user((void __user *)arg, &newmachine, sizeof(newmachine)))
+                return -EFAULT;
+            return 0;
+
+        case LIGHTPEN_IOC_SET_WATERMARK:
+            if (arg > LIGHTPEN_WATERMARK_MAX)
+                return -EINVAL;
+            // only this file, poll() picks the matching waitqueue next time
+            reader->watermark = arg;
+            return 0;
+
+        case LIGHTPEN_IOC_SET_TIMEOUT:
+            // only this file, blocking reads give up after arg ms
+            reader->timeout = arg;
+            return 0;
+
+        case LIGHTPEN_IOC_SET_EVENTFD:
+            if (copy_from_user(&newevfd, (void __user *)arg, sizeof(newevfd)))
+                return -EFAULT;
+            if (newevfd.flags & ~(LIGHTPEN_EVENTFD_VSYNC | LIGHTPEN_EVENTFD_HIT))
+                return -EINVAL;
+            ctx = NULL;
+            if (newevfd.fd >= 0) {
+                ctx = eventfd_ctx_fdget(newevfd.fd);
+                if (IS_ERR(ctx))
+                    return PTR_ERR(ctx);
+            }
+            gpio_ts_set_eventfd(reader, ctx, newevfd.flags);
+            return 0;
+
+        case LIGHTPEN_IOC_GET_VSYNC:
+            gpio_ts_vsync_snapshot(pen->station, &curvsync);
+            if (copy_to_user((void __user *)arg, &curvsync, sizeof(curvsync)))
+                return -EFAULT;
+            return 0;
+
+        case LIGHTPEN_IOC_GET_FRAME:
+            curframe = READ_ONCE(pen->station->vsync.frame);
+            if (copy_to_user((void __user *)arg, &curframe, sizeof(curframe)))
+                return -EFAULT;
+            return 0;
+
+        default:
+            return -ENOTTY;
+    }
+}
+
+//
+// mmap support: map the shared page read-only, only on light pen devices
+//
+static int gpio_ts_mmap(struct file *filp, struct vm_area_struct *vma) {
+
+    struct gpio_ts_devinfo *devinfo = ((struct gpio_ts_reader *)filp->private_data)->devinfo;
+
+    if (devinfo->pen == NULL)
+        return -ENODEV;
+    if ((vma->vm_pgoff != 0) || (vma->vm_end - vma->vm_start > PAGE_SIZE))
+        return -EINVAL;
+    if (vma->vm_flags & VM_WRITE)
+        return -EPERM;
+    vma->vm_flags &= ~VM_MAYWRITE;
+
+    return remap_pfn_range(vma, vma->vm_start, virt_to_phys(devinfo->pen->shared) >> PAGE_SHIFT, PAGE_SIZE, vma->vm_page_prot);
+}
+
+// ------------------ Multi-touch input -----------------------------------
+
+//
+// update pen's slot at VSYNC, called with pen->lock held, frames_since_hit not advanced yet
+// returns true if the slot changed
+//
+static bool gpio_ts_input_pen(struct gpio_ts_pen *pen, struct input_dev *input) {
+    int x, y;
+
+    if (pen->frames_since_hit == 0) {
+        // pen saw this frame
+        gpio_ts_calibrate(&pen->calib, pen->xpos, pen->ypos, &x, &y);
+        input_mt_slot(input, pen->index);
+        input_mt_report_slot_state(input, MT_TOOL_PEN, true);
+        pen->input_x = clamp(x, 0, gpio_ts_input_width - 1);
+        pen->input_y = clamp(y, 0, gpio_ts_input_height - 1);
+        pen->input_touch = (pen->lp_button == 0);
+        input_report_abs(input, ABS_MT_POSITION_X, pen->input_x);
+        input_report_abs(input, ABS_MT_POSITION_Y, pen->input_y);
+        input_report_abs(input, ABS_MT_PRESSURE, pen->confidence);
+        input_report_abs(input, ABS_MT_DISTANCE, !pen->input_touch);
+        pen->input_active = true;
+        return true;
+    }
+    if (pen->input_active && (pen->frames_since_hit + 1 >= GPIO_TS_OFFSCREEN_FRAMES)) {
+        // pen went off-screen, a missed odd frame alone doesn't count
+        input_mt_slot(input, pen->index);
+        input_mt_report_slot_state(input, MT_TOOL_PEN, false);
+        pen->input_active = false;
+        return true;
+    }
+    return false;
+}
+
+//
+// end of the frame: single-touch report of the first pen on screen, then SYN_REPORT
+// BTN_TOOL_PEN is in proximity (sees the screen), BTN_TOUCH follows its button so that
+// hovering over the screen is no click; only the VSYNC handler writes the input_* fields
+//
+static void gpio_ts_input_sync(struct gpio_ts_station *station) {
+    struct input_dev *input = station->input;
+    struct gpio_ts_pen *pen = NULL;
+    int i;
+
+    for (i = 0; i < station->nb_pens; i++) {
+        if (station->pens[i]->input_active) {
+            pen = station->pens[i];
+            break;
+        }
+    }
+    input_report_key(input, BTN_TOOL_PEN, pen != NULL);
+    input_report_key(input, BTN_TOUCH, (pen != NULL) && pen->input_touch);
+    if (pen != NULL) {
+        input_report_abs(input, ABS_X, pen->input_x);
+        input_report_abs(input, ABS_Y, pen->input_y);
+        input_report_abs(input, ABS_PRESSURE, READ_ONCE(pen->confidence));
+    } else {
+        input_report_abs(input, ABS_PRESSURE, 0);
+    }
+    input_sync(input);
+}
+
+//
+// register multi-touch device of the station, pens are contacts
+// no INPUT_MT_DIRECT: its pointer emulation would press BTN_TOUCH for every contact
+//
+static int gpio_ts_input_register(struct gpio_ts_station *station) {
+    struct input_dev *input;
+    int err;
+
+    input = input_allocate_device();
+    if (input == NULL)
+        return -ENOMEM;
+
+    snprintf(station->input_phys, sizeof(station->input_phys), "%s/station%d", THIS_MODULE->name, station->index);
+    input->name = "Raspberry Pi light pen";
+    input->phys = station->input_phys;
+    input->id.bustype = BUS_HOST;
+
+    input_set_abs_params(input, ABS_MT_POSITION_X, 0, gpio_ts_input_width - 1, 0, 0);
+    input_set_abs_params(input, ABS_MT_POSITION_Y, 0, gpio_ts_input_height - 1, 0, 0);
+    input_set_abs_params(input, ABS_MT_PRESSURE, 0, 255, 0, 0);
+    input_set_abs_params(input, ABS_MT_DISTANCE, 0, 1, 0, 0);
+    input_set_abs_params(input, ABS_X, 0, gpio_ts_input_width - 1, 0, 0);
+    input_set_abs_params(input, ABS_Y, 0, gpio_ts_input_height - 1, 0, 0);
+    input_set_abs_params(input, ABS_PRESSURE, 0, 255, 0, 0);
+    input_set_capability(input, EV_KEY, BTN_TOOL_PEN);
+    input_set_capability(input, EV_KEY, BTN_TOUCH);
+    __set_bit(INPUT_PROP_DIRECT, input->propbit);
+    err = input_mt_init_slots(input, station->nb_pens, 0);
+    if (err != 0) {
+        input_free_device(input);
+        return err;
+    }
+
+    err = input_register_device(input);
+    if (err != 0) {
+        input_free_device(input);
+        return err;
+    }
+    station->input = input;
+    return 0;
+}
+
+// ------------------ Sensor scope -----------------------------------------
+// debugfs <module>/<device>/scope: write N to capture every sensor pulse of the next N full fields,
+// read a PGM image of them, the exact picture the sensor saw
+
+static struct dentry *gpio_ts_debugfs;
+
+//
+// sensor was lit from start to end ns, called with pen->lock held on every falling edge,
+// or on every rising edge with start == end without pulse_width
+//
+static void gpio_ts_scope_pulse(struct gpio_ts_pen *pen, u64 start, u64 end) {
+    u64 lastvsync_ns = READ_ONCE(pen->station->vsync.lastvsync_ns);
+    u32 line;
+    u32 col;
+    u32 cols;
+    u32 rem;
+    u8 *px;
+
+    if ((pen->scope_left == 0) || (pen->scope_left > pen->scope_frames))
+        return;                 // not capturing or first field not started yet
+    if (start < lastvsync_ns)
+        start = lastvsync_ns;   // lit since before VSYNC
+    if (end < start)
+        return;
+    if (end - start > GPIO_TS_SCOPE_PULSE_MAX_NS)
+        end = start + GPIO_TS_SCOPE_PULSE_MAX_NS;
+
+    line = div_u64_rem(start - lastvsync_ns, PAL_LINE_NS, &rem);
+    col = rem / GPIO_TS_SCOPE_COL_NS;
+    cols = div_u64(end - start, GPIO_TS_SCOPE_COL_NS) + 1;
+    while ((cols-- > 0) && (line < GPIO_TS_SCOPE_LINES)) {
+        px = &pen->scope[line * GPIO_TS_SCOPE_COLS + col];
+        if (*px < U8_MAX)
+            (*px)++;
+        if (++col == GPIO_TS_SCOPE_COLS) {
+            col = 0;
+            line++;
+        }
+    }
+}
+
+//
+// count fields of a capture, called with pen->lock held on every VSYNC
+//
+static void gpio_ts_scope_vsync(struct gpio_ts_pen *pen) {
+    if (pen->scope_left > 0)
+        pen->scope_left--;
+}
+
+//
+// PGM header, always the same length so the image can be read in pieces
+//
+static int gpio_ts_scope_header(struct gpio_ts_pen *pen, char *buf, size_t size) {
+    u32 frames = READ_ONCE(pen->scope_frames);
+    u32 left = READ_ONCE(pen->scope_left);
+    u32 done = (left > frames) ? 0 : frames - left;
+
+    return scnprintf(buf, size, "P5\n# %5u of %5u fields\n%d %d\n%3u\n", done, frames,
+                     GPIO_TS_SCOPE_COLS, GPIO_TS_SCOPE_LINES, clamp_t(u32, frames, 1, U8_MAX));
+}
+
+//
+// the image, taken without the lock, a capture in progress shows as far as it got
+//
+static ssize_t gpio_ts_scope_read(struct file *filp, char __user *buf, size_t count, loff_t *ppos) {
+    struct gpio_ts_pen *pen = filp->private_data;
+    char header[48];
+    loff_t pos;
+    ssize_t ret;
+    int len;
+
+    if (READ_ONCE(pen->scope) == NULL)
+        return -ENODATA;
+    len = gpio_ts_scope_header(pen, header, sizeof(header));
+    if (*ppos < len)
+        return simple_read_from_buffer(buf, count, ppos, header, len);
+    pos = *ppos - len;
+    ret = simple_read_from_buffer(buf, count, &pos, pen->scope, GPIO_TS_SCOPE_SIZE);
+    if (ret > 0)
+        *ppos += ret;
+    return ret;
+}
+
+//
+// number of fields to capture, clears the image and starts at the next VSYNC, 0 stops
+//
+static ssize_t gpio_ts_scope_write(struct file *filp, const char __user *buf, size_t count, loff_t *ppos) {
+    struct gpio_ts_pen *pen = filp->private_data;
+    unsigned long flags;
+    unsigned int frames;
+    u8 *scope;
+    int err;
+
+    err = kstrtouint_from_user(buf, count, 10, &frames);
+    if (err != 0)
+        return err;
+    if (frames > GPIO_TS_SCOPE_FRAMES_MAX)
+        return -EINVAL;
+
+    scope = (pen->scope == NULL) ? vzalloc(GPIO_TS_SCOPE_SIZE) : NULL;
+    spin_lock_irqsave(&pen->lock, flags);
+    if (pen->scope == NULL) {
+        if (scope == NULL) {
+            spin_unlock_irqrestore(&pen->lock, flags);
+            return -ENOMEM;
+        }
+        pen->scope = scope;
+        scope = NULL;
+    }
+    pen->scope_left = 0;
+    spin_unlock_irqrestore(&pen->lock, flags);
+    vfree(scope);               // lost the race with another writer
+
+    if (frames > 0) {
+        memset(pen->scope, 0, GPIO_TS_SCOPE_SIZE);
+        spin_lock_irqsave(&pen->lock, flags);
+        pen->scope_frames = frames;
+        pen->scope_left = frames + 1;
+        spin_unlock_irqrestore(&pen->lock, flags);
+    }
+    return count;
+}
+
+static const struct file_operations gpio_ts_scope_fops = {
+    .owner = THIS_MODULE,
+    .open = simple_open,
+    .read = gpio_ts_scope_read,
+    .write = gpio_ts_scope_write,
+    .llseek = default_llseek,
+};
+
+//
+// a directory for each light pen device, named like the device, failures only cost the scope
+//
+static void gpio_ts_debugfs_init(void) {
+    struct gpio_ts_station *station;
+    struct gpio_ts_pen *pen;
+    struct dentry *dir;
+    char name[32];
+    int i;
+    int n;
+
+    gpio_ts_debugfs = debugfs_create_dir(THIS_MODULE->name, NULL);
+    if (IS_ERR_OR_NULL(gpio_ts_debugfs))
+        return;
+    for (n = 0; n < GPIO_TS_STATIONS_MAX; n++) {
+        station = stations[n];
+        for (i = 0; (station != NULL) && (i < station->nb_pens); i++) {
+            pen = station->pens[i];
+            if (n == 0)
+                snprintf(name, sizeof(name), GPIO_TS_ENTRIES_NAME, pen->devinfo->num);
+            else
+                snprintf(name, sizeof(name), GPIO_TS_STATION_ENTRIES_NAME, n, pen->devinfo->num);
+            dir = debugfs_create_dir(name, gpio_ts_debugfs);
+            if (!IS_ERR_OR_NULL(dir))
+                debugfs_create_file("scope", 0600, dir, pen, &gpio_ts_scope_fops);
+        }
+    }
+}
+
+// ------------------ Timestamp source -------------------------------------
+// with timestamp_source=cycles ns = ref_ns + (cycles - ref_cycles) * mult >> GPIO_TS_CLOCK_SHIFT,
+// mult is measured over the previous frame so it follows the clock's drift; the difference is
+// signed, a raw timestamp taken before the reference (IRQ thread, another CPU) comes out earlier
+
+static DEFINE_SEQLOCK(gpio_ts_clock_lock);
+static u64 gpio_ts_clock_ref_cycles;
+static u64 gpio_ts_clock_ref_ns;
+static u32 gpio_ts_clock_mult;
+
+//
+// raw timestamp, the first thing every handler does
+//
+static inline u64 gpio_ts_now(void) {
+    if (gpio_ts_cycles)
+        return get_cycles();
+    return ktime_get_ns();
+}
+
+//
+// cycles from ref to raw, negative if raw was read first; get_cycles() is only as wide as
+// cycles_t (32 bits on ARM32), at that width the difference survives a wrap of the counter
+//
+static inline s64 gpio_ts_cycles_delta(u64 raw, u64 ref) {
+    cycles_t delta = (cycles_t)raw - (cycles_t)ref;
+
+    if (sizeof(cycles_t) < sizeof(s64))
+        return (s32)delta;
+    return (s64)delta;
+}
+
+//
+// raw timestamp to CLOCK_MONOTONIC ns
+//
+static u64 gpio_ts_clock_ns(u64 raw) {
+    unsigned int seq;
+    s64 delta;
+    u64 ref_ns;
+    u32 mult;
+
+    if (!gpio_ts_cycles)
+        return raw;
+    do {
+        seq = read_seqbegin(&gpio_ts_clock_lock);
+        delta = gpio_ts_cycles_delta(raw, gpio_ts_clock_ref_cycles);
+        ref_ns = gpio_ts_clock_ref_ns;
+        mult = gpio_ts_clock_mult;
+    } while (read_seqretry(&gpio_ts_clock_lock, seq));
+
+    if (delta < 0)
+        return ref_ns - mul_u64_u32_shr(-delta, mult, GPIO_TS_CLOCK_SHIFT);
+    return ref_ns + mul_u64_u32_shr(delta, mult, GPIO_TS_CLOCK_SHIFT);
+}
+
+//
+// take a new reference pair and the multiplier since the previous one, on every VSYNC with
+// interrupts disabled; VSYNCs of all stations keep the same correlation up to date, but one
+// that comes right after another station's doesn't, so mult is measured over a long interval
+//
+static void gpio_ts_clock_sync(void) {
+    u64 cycles = get_cycles();
+    u64 ns = ktime_get_ns();
+    s64 dcycles;
+    u64 dns;
+
+    write_seqlock(&gpio_ts_clock_lock);
+    dns = ns - gpio_ts_clock_ref_ns;
+    if (dns >= GPIO_TS_CLOCK_MIN_NS) {
+        dcycles = gpio_ts_cycles_delta(cycles, gpio_ts_clock_ref_cycles);
+        if ((dns < GPIO_TS_CLOCK_MAX_NS) && (dcycles > 0))
+            gpio_ts_clock_mult = div64_u64(dns << GPIO_TS_CLOCK_SHIFT, dcycles);
+        gpio_ts_clock_ref_cycles = cycles;
+        gpio_ts_clock_ref_ns = ns;
+    }
+    write_sequnlock(&gpio_ts_clock_lock);
+}
+
+//
+// first correlation, measured over GPIO_TS_CLOCK_INIT_MS (20ms) before any interrupt is requested
+// returns false if the cycle counter isn't usable
+//
+static bool gpio_ts_clock_init(void) {
+    gpio_ts_clock_ref_cycles = get_cycles();
+    gpio_ts_clock_ref_ns = ktime_get_ns();
+    msleep(GPIO_TS_CLOCK_INIT_MS);
+    if (get_cycles() == gpio_ts_clock_ref_cycles)
+        return false;           // get_cycles() is 0 without a usable counter
+    gpio_ts_clock_sync();
+    return gpio_ts_clock_mult > 0;
+}
+
+// ------------------ IRQ handler----------- ----------------------------
+
+//
+// confidence from lines lit in a row and their average pulse width, called with pen->lock held
+//
+static void gpio_ts_confidence(struct gpio_ts_pen *pen) {
+    u32 lines_score = min_t(u32, pen->run_lines, GPIO_TS_CONF_LINES) * 255 / GPIO_TS_CONF_LINES;
+    u32 width_score = 255;
+    u32 width;
+
+    // falling edge of the first pulse not seen yet, go by lines alone
+    if (pen->run_pulses > 0) {
+        width = pen->run_pulse_ns / pen->run_pulses;
+        width_score = min_t(u32, width, GPIO_TS_CONF_PULSE_NS) * 255 / GPIO_TS_CONF_PULSE_NS;
+    }
+    pen->confidence = lines_score * width_score / 255;
+    pen->lines = pen->run_lines;
+}
+
+//
+// track pulses of consecutive lines, called with pen->lock held
+// returns true on a rising edge, the falling ones need no further processing
+// with pulse_width the edge is told by the sensor level: dark within GPIO_TS_PULSE_MAX_NS of
+// the pulse start is its falling edge, anything else a rising edge even if its pulse is over
+//
+static bool gpio_ts_sensor_edge(struct gpio_ts_pen *pen, long usecs, u64 timestamp) {
+    long gap;
+
+    if (pen->in_pulse && ((s64)(timestamp - pen->pulse_start_ns) <= GPIO_TS_PULSE_MAX_NS) &&
+        (gpio_get_value(pen->gpio_sensor) == 0)) {
+        // falling edge
+        pen->in_pulse = false;
+        pen->run_pulse_ns += (u32)min_t(u64, timestamp - pen->pulse_start_ns, U16_MAX);
+        if (unlikely(pen->scope_left > 0))
+            gpio_ts_scope_pulse(pen, pen->pulse_start_ns, timestamp);
+        if (pen->run_pulses < U8_MAX)
+            pen->run_pulses++;
+        if (pen->sample_run) {
+            gpio_ts_confidence(pen);
+            gpio_ts_publish(pen, false);
+        }
+        return false;
+    }
+
+    // rising edge, sensor might be dark again already if the pulse was short
+    pen->in_pulse = gpio_ts_pulse_width;
+    pen->pulse_start_ns = timestamp;
+    if (!gpio_ts_pulse_width && unlikely(pen->scope_left > 0))
+        gpio_ts_scope_pulse(pen, timestamp, timestamp);
+    gap = usecs - pen->lastedge;
+    pen->lastedge = usecs;
+    if ((gap > PAL_LINE_LENGTH / 2) && (gap <= PAL_LINE_LENGTH * 3 / 2)) {
+        if (pen->run_lines < U8_MAX)
+            pen->run_lines++;
+        // one more line lit, the only update without pulse_width
+        if (pen->sample_run) {
+            gpio_ts_confidence(pen);
+            gpio_ts_publish(pen, false);
+        }
+    } else {
+        pen->run_lines = 1;
+        pen->run_pulses = 0;
+        pen->run_pulse_ns = 0;
+        pen->sample_run = false;
+    }
+    return true;
+}
+
+//
+// light pen sensor saw the beam, each pen takes only its own lock
+//
+static void gpio_ts_sensor_event(struct gpio_ts_pen *pen, long usecs, u64 timestamp) {
+
+    struct gpio_ts_station *station = pen->station;
+    struct gpio_ts_vsync *vsync = &station->vsync;
+    u64 lastvsync_ns = READ_ONCE(vsync->lastvsync_ns);
+    u32 frame_period = READ_ONCE(vsync->frame_period);
+    bool wake = false;
+    u64 delta;
+    u32 offset;
+    u32 usecoffset;
+
+    spin_lock(&pen->lock);
+    if (!gpio_ts_sensor_edge(pen, usecs, timestamp)) {
+        spin_unlock(&pen->lock);
+        return;
+    }
+    // timestamped before the VSYNC it's processed after: the end of the previous field,
+    // e.g. an injected DRM VSYNC shifted by vsync_phase_ns, the offset would wrap around;
+    // a field or more after it: the next VSYNC is late (relayed by userspace) or none came yet
+    delta = timestamp - lastvsync_ns;
+    if (((s64)delta < 0) || (delta >= frame_period)) {
+        spin_unlock(&pen->lock);
+        return;
+    }
+    offset = delta;
+    usecoffset = offset / NSEC_PER_USEC;
+    pen->oddeven = gpio_ts_field(station);
+    if (pen->read_mode == LIGHTPEN_MODE_TRIGGER) {              // flash frame can be in either field
+        pen->ypos = usecoffset / PAL_LINE_LENGTH;
+        pen->xpos = usecoffset - (pen->ypos*PAL_LINE_LENGTH);
+        wake = gpio_ts_trigger_hit(pen, timestamp);
+        if (wake)
+            gpio_ts_eventfd_signal(pen, LIGHTPEN_EVENTFD_HIT);
+    } else if ((timestamp - pen->lastlp_ns > 128 * NSEC_PER_USEC) && (offset > 128 * NSEC_PER_USEC) && (pen->oddeven!=0)) {
+        // need at least some lines of difference from the previous hit and VSYNC, and only even/odd frame
+        pen->lp_button = gpio_get_value(pen->gpio_button);
+        pen->nsoffset = offset;
+        pen->lastlp_ns = timestamp;
+        pen->lp_frame = READ_ONCE(vsync->frame);
+        pen->ypos = usecoffset / PAL_LINE_LENGTH;
+        pen->xpos = usecoffset - (pen->ypos*PAL_LINE_LENGTH);
+        pen->frames_since_hit = 0;
+        pen->sample_run = true;
+        gpio_ts_confidence(pen);
+        gpio_ts_publish(pen, true);
+        gpio_ts_shared_hit(pen);
+        gpio_ts_eventfd_signal(pen, LIGHTPEN_EVENTFD_HIT);
+        if (pen->read_mode == LIGHTPEN_MODE_ZONES)
+            wake = gpio_ts_zone_update(pen);
+        else
+            wake = true;
+    }
+    spin_unlock(&pen->lock);
+
+    if (wake)
+        wake_up(&pen->devinfo->waitqueue);
+}
+
+//
+// VSYNC: advance the station's tracker, then let every pen of the station finish its frame
+//
+static void gpio_ts_vsync_event(struct gpio_ts_station *station, u64 timestamp) {
+
+    struct gpio_ts_vsync *vsync = &station->vsync;
+    struct gpio_ts_pen *pen;
+    bool input_changed = false;
+    bool frame_wake;
+    u64 period;
+    u32 frame;
+    bool wake;
+    int i;
+
+    if (gpio_ts_cycles)
+        gpio_ts_clock_sync();
+
+    write_seqcount_begin(&vsync->seq);
+    // nothing to measure against on the first VSYNC; a gap after missed VSYNCs or signal loss
+    // isn't a field either, keep the last plausible period then
+    period = timestamp - vsync->lastvsync_ns;
+    if (vsync->lastvsync_ns == 0)
+        vsync->frame_period = PAL_FIELD_NS;
+    else if ((period >= PAL_FIELD_NS / 2) && (period <= PAL_FIELD_NS * 3 / 2))
+        vsync->frame_period = period;
+    vsync->lastvsync_ns = timestamp;
+    if (station->gpio_odd_even < 0)
+        vsync->field = !vsync->field;
+    else
+        vsync->field = gpio_get_value(station->gpio_odd_even);
+    frame = ++vsync->frame;
+    write_seqcount_end(&vsync->seq);
+
+    for (i = 0; i < station->nb_pens; i++) {
+        pen = station->pens[i];
+        spin_lock(&pen->lock);
+        wake = false;
+        pen->sample_run = false;        // run is over, confidence of the sample is final
+        pen->in_pulse = false;          // no pulse lasts over VSYNC, don't take the next rising edge for its end
+        if (station->input != NULL)
+            input_changed |= gpio_ts_input_pen(pen, station->input);
+        if (pen->frames_since_hit < GPIO_TS_OFFSCREEN_FRAMES)
+            pen->frames_since_hit++;
+        else
+            wake = gpio_ts_zone_leave(pen);
+        if (pen->read_mode == LIGHTPEN_MODE_TRIGGER)
+            wake |= gpio_ts_trigger_vsync(pen, frame);
+        gpio_ts_shared_vsync(pen, frame);
+        gpio_ts_scope_vsync(pen);
+        gpio_ts_eventfd_signal(pen, LIGHTPEN_EVENTFD_VSYNC);
+        // frame is complete for LIGHTPEN_WATERMARK_FRAME readers
+        frame_wake = (pen->rec_frame_head != pen->rec_head) || (pen->ev_frame_head != pen->ev_head);
+        WRITE_ONCE(pen->rec_frame_head, pen->rec_head);
+        WRITE_ONCE(pen->ev_frame_head, pen->ev_head);
+        spin_unlock(&pen->lock);
+        if (wake)
+            wake_up(&pen->devinfo->waitqueue);
+        if (frame_wake)
+            wake_up(&pen->frame_wait);
+    }
+
+    wake_up(&station->devtable[GPIO_TS_VSYNC_INDEX]->waitqueue);
+
+    // all pens of the frame in one report
+    if (input_changed) {
+        gpio_ts_input_sync(station);
+    }
+}
+
+//
+// handles GPIO interrupts
+// ignores interrupts when no file is open for the device
+// otherwise gets the current timestamp
+// then stores the timestamp in the fifo queue for this device 
+// and wakes up the associated waitqueue so that poll() gets woken up if it's waiting
+//  
+static irqreturn_t gpio_ts_handler(int irq, void *arg) {
+
+    u64 timestamp;
+    struct gpio_ts_devinfo *devinfo;
+
+    if (module_unload) {
+        return -IRQ_NONE; // ignore if module is unloading
+    }
+
+    // first of all get the timestamp
+    timestamp = gpio_ts_now();
+
+    // get the device info structure for this gpio from the file pointer
+    // note that it's just a pointer to devtable[gpio_index]
+    devinfo = (struct gpio_ts_devinfo *)arg;
+
+    if (devinfo == NULL) {
+        return -IRQ_NONE;
+    }
+
+    gpio_ts_event(devinfo, timestamp);
+
+    return IRQ_HANDLED;
+}
+
+//
+// sensor or VSYNC edge at raw timestamp, from the ISR or the poll thread with interrupts disabled
+//
+static void gpio_ts_event(struct gpio_ts_devinfo *devinfo, u64 timestamp) {
+    long usecs;
+
+    timestamp = gpio_ts_clock_ns(timestamp);
+    if (unlikely(READ_ONCE(gpio_ts_learning))) {
+        devinfo->learn_ns = timestamp;
+        smp_wmb();
+        WRITE_ONCE(devinfo->learn_count, devinfo->learn_count + 1);
+    }
+    timestamp -= (devinfo->pen != NULL) ? READ_ONCE(gpio_ts_sensor_latency_ns) : READ_ONCE(gpio_ts_vsync_latency_ns);
+
+    // remember last timestamp
+    usecs = div_u64(timestamp, 1000);
+
+    // do we do calculations now?
+    if (devinfo->pen != NULL)   // if this is lp irq
+        gpio_ts_sensor_event(devinfo->pen, usecs, timestamp);
+    else                        // if this is vsync just remember about it
+        gpio_ts_vsync_event(devinfo->station, timestamp);
+}
+
+//
+// threaded mode, hard handler: timestamp only, the line stays masked until the thread is done
+//
+static irqreturn_t gpio_ts_hardirq(int irq, void *arg) {
+    struct gpio_ts_devinfo *devinfo = (struct gpio_ts_devinfo *)arg;
+
+    if (module_unload || (devinfo == NULL))
+        return IRQ_NONE;
+    devinfo->irq_ns = gpio_ts_now();
+    return IRQ_WAKE_THREAD;
+}
+
+//
+// threaded mode, IRQ thread: takes over irq_policy and irq_priority when they change,
+// then processes the edge with interrupts disabled like the hard handler would
+//
+static irqreturn_t gpio_ts_irq_thread(int irq, void *arg) {
+    struct gpio_ts_devinfo *devinfo = (struct gpio_ts_devinfo *)arg;
+    struct sched_param param;
+    unsigned long flags;
+    int gen = READ_ONCE(gpio_ts_sched_gen);
+
+    if (devinfo->sched_gen != gen) {
+        devinfo->sched_gen = gen;
+        param.sched_priority = (gpio_ts_irq_policy == SCHED_NORMAL) ? 0 : gpio_ts_irq_priority;
+        sched_setscheduler_nocheck(current, gpio_ts_irq_policy, &param);
+    }
+
+    local_irq_save(flags);
+    gpio_ts_event(devinfo, devinfo->irq_ns);
+    local_irq_restore(flags);
+    return IRQ_HANDLED;
+}
+
+// ------------------ IRQ affinity and priority -----------------------------
+// sysfs writes to the parameters run with kernel_param_lock held, init and exit take it too
+// around requesting and freeing interrupts
+
+//
+// move all requested interrupts to gpio_ts_irq_cpu, VSYNC and sensors share the core so the
+// VSYNC tracker stays in its cache; -1 only drops the hint and leaves them where they are
+//
+static void gpio_ts_irq_affinity(void) {
+    struct gpio_ts_station *station;
+    int i;
+    int n;
+
+    for (n = 0; n < GPIO_TS_STATIONS_MAX; n++) {
+        station = stations[n];
+        for (i = 0; (station != NULL) && (i < station->nb_gpios); i++) {
+            if (station->irq_numbers[i] < 0)
+                continue;
+            irq_set_affinity_hint(station->irq_numbers[i], (gpio_ts_irq_cpu < 0) ? NULL : cpumask_of(gpio_ts_irq_cpu));
+        }
+    }
+}
+
+static int gpio_ts_irq_cpu_set(const char *val, const struct kernel_param *kp) {
+    int cpu;
+    int err;
+
+    err = kstrtoint(val, 10, &cpu);
+    if (err != 0)
+        return err;
+    if ((cpu < -1) || (cpu >= (int)nr_cpu_ids) || ((cpu >= 0) && !cpu_online(cpu)))
+        return -EINVAL;
+    gpio_ts_irq_cpu = cpu;
+    if (gpio_ts_irqs_ready)     // otherwise init applies it once the interrupts are requested
+        gpio_ts_irq_affinity();
+    return 0;
+}
+
+static const struct kernel_param_ops gpio_ts_irq_cpu_ops = {
+    .set = gpio_ts_irq_cpu_set,
+    .get = param_get_int,
+};
+module_param_cb(irq_cpu, &gpio_ts_irq_cpu_ops, &gpio_ts_irq_cpu, 0644);
+
+static const char *const gpio_ts_policy_names[] = {
+    [SCHED_NORMAL] = "other",
+    [SCHED_FIFO] = "fifo",
+    [SCHED_RR] = "rr",
+};
+
+static int gpio_ts_irq_policy_set(const char *val, const struct kernel_param *kp) {
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(gpio_ts_policy_names); i++) {
+        if (sysfs_streq(val, gpio_ts_policy_names[i])) {
+            gpio_ts_irq_policy = i;
+            WRITE_ONCE(gpio_ts_sched_gen, gpio_ts_sched_gen + 1);
+            return 0;
+        }
+    }
+    return -EINVAL;
+}
+
+static int gpio_ts_irq_policy_get(char *buffer, const struct kernel_param *kp) {
+    return sprintf(buffer, "%s\n", gpio_ts_policy_names[gpio_ts_irq_policy]);
+}
+
+static const struct kernel_param_ops gpio_ts_irq_policy_ops = {
+    .set = gpio_ts_irq_policy_set,
+    .get = gpio_ts_irq_policy_get,
+};
+module_param_cb(irq_policy, &gpio_ts_irq_policy_ops, NULL, 0644);
+
+static int gpio_ts_irq_priority_set(const char *val, const struct kernel_param *kp) {
+    int prio;
+    int err;
+
+    err = kstrtoint(val, 10, &prio);
+    if (err != 0)
+        return err;
+    if ((prio < 1) || (prio >= MAX_RT_PRIO))
+        return -EINVAL;
+    gpio_ts_irq_priority = prio;
+    WRITE_ONCE(gpio_ts_sched_gen, gpio_ts_sched_gen + 1);
+    return 0;
+}
+
+static const struct kernel_param_ops gpio_ts_irq_priority_ops = {
+    .set = gpio_ts_irq_priority_set,
+    .get = param_get_int,
+};
+module_param_cb(irq_priority, &gpio_ts_irq_priority_ops, &gpio_ts_irq_priority, 0644);
+
+// ------------------ Latency compensation ---------------------------------
+
+//
+// learn GPIO to handler latency for ms: spin on the GPIO levels while the handlers keep running,
+// the difference between an edge seen here and the same edge in gpio_ts_event is one sample;
+// handlers that ran on this CPU come out negative and are dropped, as are edges seen late
+// because this loop got preempted (over GPIO_TS_LEARN_WAIT_NS)
+// runs in its own thread after interrupts are set up, kernel_param_lock is held only to publish;
+// sensors learn only if lit
+//
+static void gpio_ts_latency_learn(unsigned int ms) {
+    int levels[GPIO_TS_STATIONS_MAX][GPIO_TS_NB_ENTRIES_MAX];
+    u64 sum[2] = { 0, 0 };              // sensors, VSYNC
+    u32 nb[2] = { 0, 0 };
+    struct gpio_ts_station *station;
+    struct gpio_ts_devinfo *devinfo;
+    u64 edge_ns;
+    u64 end;
+    s64 latency;
+    u32 count;
+    int level;
+    int vsync;
+    int i;
+    int n;
+
+    for (n = 0; n < GPIO_TS_STATIONS_MAX; n++) {
+        station = stations[n];
+        for (i = 0; (station != NULL) && (i < station->nb_gpios); i++) {
+            if (station->irq_numbers[i] >= 0)
+                levels[n][i] = gpio_get_value(station->gpios[i]);
+        }
+    }
+    WRITE_ONCE(gpio_ts_learning, true);
+
+    end = ktime_get_ns() + (u64)ms * NSEC_PER_MSEC;
+    while ((ktime_get_ns() < end) && !kthread_should_stop()) {
+        for (n = 0; n < GPIO_TS_STATIONS_MAX; n++) {
+            station = stations[n];
+            for (i = 0; (station != NULL) && (i < station->nb_gpios); i++) {
+                if (station->irq_numbers[i] < 0)
+                    continue;
+                devinfo = station->devtable[i];
+                count = READ_ONCE(devinfo->learn_count);
+                level = gpio_get_value(station->gpios[i]);
+                if (level == levels[n][i])
+                    continue;
+                edge_ns = ktime_get_ns();
+                levels[n][i] = level;
+                vsync = (devinfo->pen == NULL);
+                if ((level == 0) && (vsync || !gpio_ts_pulse_width))
+                    continue;           // no interrupt on the falling edge
+
+                // wait for the handler of this edge
+                while ((READ_ONCE(devinfo->learn_count) == count) && (ktime_get_ns() - edge_ns < GPIO_TS_LEARN_WAIT_NS))
+                    cpu_relax();
+                if (READ_ONCE(devinfo->learn_count) == count)
+                    continue;
+                smp_rmb();
+                latency = (s64)(READ_ONCE(devinfo->learn_ns) - edge_ns);
+                if ((latency <= 0) || (latency >= GPIO_TS_LEARN_WAIT_NS))
+                    continue;
+                sum[vsync] += latency;
+                nb[vsync]++;
+            }
+        }
+        cond_resched();
+    }
+
+    WRITE_ONCE(gpio_ts_learning, false);
+    if (kthread_should_stop())
+        return;                 // module is going away
+
+    kernel_param_lock(THIS_MODULE);
+    if (nb[1] > 0) {
+        WRITE_ONCE(gpio_ts_vsync_latency_ns, (int)div_u64(sum[1], nb[1]));
+        printk(KERN_INFO "%s: VSYNC latency %d ns from %u edges\n", THIS_MODULE->name, gpio_ts_vsync_latency_ns, nb[1]);
+    } else {
+        printk(KERN_INFO "%s: no VSYNC edges seen, vsync_latency_ns stays %d\n", THIS_MODULE->name, gpio_ts_vsync_latency_ns);
+    }
+    if (nb[0] > 0) {
+        WRITE_ONCE(gpio_ts_sensor_latency_ns, (int)div_u64(sum[0], nb[0]));
+        printk(KERN_INFO "%s: sensor latency %d ns from %u edges\n", THIS_MODULE->name, gpio_ts_sensor_latency_ns, nb[0]);
+    } else {
+        printk(KERN_INFO "%s: no sensor edges seen (point a pen at the screen), sensor_latency_ns stays %d\n", THIS_MODULE->name, gpio_ts_sensor_latency_ns);
+    }
+    kernel_param_unlock(THIS_MODULE);
+}
+
+static int gpio_ts_latency_thread(void *data) {
+    gpio_ts_latency_learn((unsigned int)(uintptr_t)data);
+    WRITE_ONCE(gpio_ts_learn_busy, false);
+    return 0;
+}
+
+//
+// wait for the last learning thread, called without kernel_param_lock as the thread publishes under it
+// and once no new thread can start (gpio_ts_irqs_ready false), or from gpio_ts_latency_start()
+// after the thread is done
+//
+static void gpio_ts_latency_stop(void) {
+    if (gpio_ts_learn_task == NULL)
+        return;
+    kthread_stop(gpio_ts_learn_task);
+    put_task_struct(gpio_ts_learn_task);
+    gpio_ts_learn_task = NULL;
+    WRITE_ONCE(gpio_ts_learn_busy, false);
+}
+
+//
+// learn in a thread, away from the CPU taking the interrupts when it's known so that the handlers
+// run while the thread sees the edge; called with kernel_param_lock held after interrupts are set up
+//
+static int gpio_ts_latency_start(unsigned int ms) {
+    struct task_struct *task;
+    unsigned int cpu;
+
+    if (gpio_ts_poll_cpu >= 0) {
+        printk(KERN_INFO "%s: no interrupts in busy-poll mode, nothing to learn\n", THIS_MODULE->name);
+        return 0;
+    }
+    if (READ_ONCE(gpio_ts_learn_busy))
+        return -EBUSY;
+    gpio_ts_latency_stop();     // reap the previous thread, it's done
+
+    task = kthread_create(gpio_ts_latency_thread, (void *)(uintptr_t)ms, "lightpen-learn");
+    if (IS_ERR(task))
+        return PTR_ERR(task);
+    cpu = (gpio_ts_irq_cpu >= 0) ? cpumask_any_but(cpu_online_mask, gpio_ts_irq_cpu) : nr_cpu_ids;
+    if (cpu < nr_cpu_ids)
+        kthread_bind(task, cpu);
+    get_task_struct(task);      // it may be done before gpio_ts_latency_stop()
+    gpio_ts_learn_task = task;
+    WRITE_ONCE(gpio_ts_learn_busy, true);
+    wake_up_process(task);
+    return 0;
+}
+
+//
+// writing latency_learn_ms starts learning in the background, -EBUSY while it's still learning;
+// at load time init does it
+//
+static int gpio_ts_latency_learn_set(const char *val, const struct kernel_param *kp) {
+    unsigned int ms;
+    int err;
 
-// button state (read when lightpen sensor has signal)
-static int gpio_lp_button;
-// odd/even state (to determine if lightpen/vsync info should be processed)
-static int gpio_odd_even;
-// the module parameters definition
-module_param(gpio_lp_button, int, 0644);
-module_param(gpio_odd_even, int, 0644);
+    err = kstrtouint(val, 10, &ms);
+    if (err != 0)
+        return err;
+    if (ms > 10000)
+        return -EINVAL;
+    if ((ms > 0) && gpio_ts_irqs_ready) {
+        err = gpio_ts_latency_start(ms);
+        if (err != 0)
+            return err;
+    }
+    gpio_ts_latency_learn_ms = ms;
+    return 0;
+}
 
-// ------------------ Driver private data type ------------------------------
+static const struct kernel_param_ops gpio_ts_latency_learn_ops = {
+    .set = gpio_ts_latency_learn_set,
+    .get = param_get_uint,
+};
+module_param_cb(latency_learn_ms, &gpio_ts_latency_learn_ops, &gpio_ts_latency_learn_ms, 0644);
 
-// the irq's assigned to the gpios
-static int irq_numbers[GPIO_TS_NB_ENTRIES_MAX];
-// the device info table
-static struct gpio_ts_devinfo *devtable[GPIO_TS_NB_ENTRIES_MAX];
-// global flag to block irq handler on module unload
-static bool module_unload = false;
+// ------------------ Busy-poll sampling ------------------------------------
 
-// ------------------ Driver private methods -------------------------------
+//
+// how long the poll thread may sleep for the station, 0 while its picture is being drawn
+//
+static u64 gpio_ts_poll_idle(struct gpio_ts_station *station, u64 now) {
+    u64 lastvsync_ns = READ_ONCE(station->vsync.lastvsync_ns);
+    u64 since = now - lastvsync_ns;
+
+    if ((lastvsync_ns == 0) || (since > GPIO_TS_POLL_NOSIGNAL_NS))
+        return GPIO_TS_POLL_NOSIGNAL_SLEEP_NS;
+    if (since < GPIO_TS_POLL_BLANK_NS)
+        return GPIO_TS_POLL_BLANK_NS - since;
+    return 0;
+}
 
 //
-// open the GPIO device, ensuring exclusive access
-// clear the fifo buffer
-// and store the devinfo struct in the private file data
+// spin on sensor and VSYNC levels of all stations, an edge is processed right away just like
+// gpio_ts_handler would, VSYNC on the rising edge only; sleeps through vertical blanking
 //
-static int gpio_ts_open(struct inode *ind, struct file *filp) {
+static int gpio_ts_poll_thread(void *arg) {
+    int levels[GPIO_TS_STATIONS_MAX][GPIO_TS_NB_ENTRIES_MAX];
+    struct gpio_ts_station *station;
+    struct gpio_ts_devinfo *devinfo;
+    unsigned long flags;
+    u64 timestamp;
+    u64 idle_ns;
+    int level;
+    int i;
+    int n;
+
+    // no edges on the first pass
+    for (n = 0; n < GPIO_TS_STATIONS_MAX; n++) {
+        station = stations[n];
+        for (i = 0; (station != NULL) && (i < station->nb_gpios); i++) {
+            if ((i != GPIO_TS_VSYNC_INDEX) || !gpio_ts_vsync_drm)
+                levels[n][i] = gpio_get_value(station->gpios[i]);
+        }
+    }
 
-    int gpio_index = iminor(ind);
-    struct gpio_ts_devinfo *devinfo = devtable[gpio_index];
-    // ensure exclusive access
-    if (devinfo->opencount > 0) {
-        return -EBUSY;
+    while (!kthread_should_stop()) {
+        idle_ns = U64_MAX;
+        for (n = 0; n < GPIO_TS_STATIONS_MAX; n++) {
+            station = stations[n];
+            if (station == NULL)
+                continue;
+            for (i = 0; i < station->nb_gpios; i++) {
+                if ((i == GPIO_TS_VSYNC_INDEX) && gpio_ts_vsync_drm)
+                    continue;
+                level = gpio_get_value(station->gpios[i]);
+                if (level == levels[n][i])
+                    continue;
+                timestamp = gpio_ts_now();
+                levels[n][i] = level;
+                devinfo = station->devtable[i];
+                if ((level == 0) && ((devinfo->pen == NULL) || !gpio_ts_pulse_width))
+                    continue;           // VSYNC on the rising edge only, sensors too unless measuring pulses
+                if ((devinfo->pen != NULL) && !READ_ONCE(devinfo->pen->sensor_irq_enabled))
+                    continue;
+                local_irq_save(flags);
+                gpio_ts_event(devinfo, timestamp);
+                local_irq_restore(flags);
+            }
+            idle_ns = min(idle_ns, gpio_ts_poll_idle(station, ktime_get_ns()));
+        }
+
+        if (idle_ns > 0)
+            usleep_range(div_u64(idle_ns, 1000), div_u64(idle_ns, 1000) + 50);
+        else
+            cond_resched();
     }
-    devinfo->opencount++;
-    filp->private_data = devinfo;
 
     return 0;
 }
 
 //
-// close the GPIO device: remove the devinfo struct from the file private data
-// 
-static int gpio_ts_release(struct inode *ind, struct file *filp) {
-
-    int gpio_index = iminor(ind);
-    devtable[gpio_index]->opencount--;
-    filp->private_data = NULL;
-
+// start the poll thread on gpio_ts_poll_cpu, stations must be set up
+//
+static int gpio_ts_poll_start(void) {
+    struct task_struct *task;
+
+    task = kthread_create(gpio_ts_poll_thread, NULL, "%s-poll", THIS_MODULE->name);
+    if (IS_ERR(task))
+        return PTR_ERR(task);
+    kthread_bind(task, gpio_ts_poll_cpu);
+    gpio_ts_poll_task = task;
+    wake_up_process(task);
+    printk(KERN_INFO "%s: busy-poll sampling on CPU %d\n", THIS_MODULE->name, gpio_ts_poll_cpu);
     return 0;
 }
 
-static char message[256] = {0}; // device read message
-static short lp_button;         // light pen button state (read during LP event)
-static long lastvsync;          // usec timestamp of last vsync interrupt
-static long lastlp;             // usec timestamp of last LP event interrupt
-static int xpos;                // calculated X coordinate
-static int ypos;                // calculated Y coordinate
-static bool have_data;          // data availability flag (once every 2 frames)
+// ------------------ Driver private global data ----------------------------
+
+static struct file_operations gpio_ts_fops = {
+    .owner = THIS_MODULE, 
+    .open = gpio_ts_open, 
+    .release = gpio_ts_release, 
+    .read_iter = gpio_ts_read_iter,
+    .poll = gpio_ts_poll,
+    .unlocked_ioctl = gpio_ts_ioctl,
+    .mmap = gpio_ts_mmap,
+};
+
+static dev_t gpio_ts_dev;
+static struct cdev gpio_ts_cdev;
+static struct class *gpio_ts_class = NULL;
+
+// ------------------ Driver init and exit methods --------------------------
+
 //
-static long usecoffset;         // time difference between last LP event and VSYNC
-static int oddeven;             // marker if frame during LP event was even or odd
+// allocate light pen state and its shared page, mmap() needs the page reserved
+//
+static struct gpio_ts_pen *gpio_ts_alloc_pen(struct gpio_ts_station *station, int index) {
+    struct gpio_ts_pen *pen;
+
+    pen = kzalloc(sizeof(struct gpio_ts_pen), GFP_KERNEL);
+    if (pen == NULL)
+        return NULL;
+    pen->shared = (struct lightpen_shared *)get_zeroed_page(GFP_KERNEL);
+    if (pen->shared == NULL) {
+        kfree(pen);
+        return NULL;
+    }
+    SetPageReserved(virt_to_page(pen->shared));
+
+    spin_lock_init(&pen->lock);
+    seqcount_init(&pen->sample_seq);
+    seqcount_init(&pen->ev_seq);
+    init_waitqueue_head(&pen->frame_wait);
+    INIT_LIST_HEAD(&pen->eventfds);
+    pen->station = station;
+    pen->index = index;
+    pen->gpio_sensor = station->gpios[(index == 0) ? 0 : index + 1];
+    pen->gpio_button = station->gpio_button[index];
+    pen->read_mode = LIGHTPEN_MODE_COORDS;
+    pen->calib.scalex = 256;
+    pen->calib.scaley = 256;
+    pen->cur_zone = -1;
+    pen->zone_button = 1;
+    pen->trig_state = GPIO_TS_TRIG_IDLE;
+    pen->trig_button = 1;
+    pen->sensor_irq_enabled = true;
+    pen->machine = gpio_ts_machines[LIGHTPEN_MACHINE_RAW];
+    return pen;
+}
+
+static void gpio_ts_free_pen(struct gpio_ts_pen *pen) {
+    vfree(pen->scope);
+    ClearPageReserved(virt_to_page(pen->shared));
+    free_page((unsigned long)pen->shared);
+    kfree(pen);
+}
 
 //
-// read timestamps from the FIFO buffer, if any
+// check module parameters of station index, 0 if the station isn't used
+// returns number of GPIOs of the station or negative error
 //
-static ssize_t gpio_ts_read(struct file *filp, char *buffer, size_t length, loff_t *offset) {
-    ssize_t lg;
-    int err;
+static int gpio_ts_check_station(int index) {
+    int nb_gpios = gpio_ts_nb_gpios[index];
+    int gpio;
+    int i;
 
-    // do we have any data?
-    if (!have_data) {
-        struct gpio_ts_devinfo *devinfo = filp->private_data;
-        // non-blocking read return now
-        if (filp->f_flags & O_NONBLOCK)
-            return -EAGAIN;
-        // blocking read has to wait
-        wait_event(devinfo->waitqueue, have_data);
+    if ((nb_gpios == 0) && (index > 0))
+        return 0;
+
+    // sanity checks
+    if (nb_gpios < 2) {
+        printk(KERN_ERR "%s: station %d: I need at least two GPIO inputs (lp,vsync[,lp...] - in that order)\n", THIS_MODULE->name, index);
+        return -EINVAL;
     }
 
-//    sprintf(message, "%i,%i,%i,%i,%ld,%ld,%ld\n", xpos, ypos, lp_button, oddeven, lastvsync, lastlp, usecoffset);
-    sprintf(message, "%i,%i,%i\n", xpos, ypos, lp_button);
-    lg = strlen(message);
+    if (gpio_lp_button_nb[index] != nb_gpios - 1) {
+        printk(KERN_ERR "%s: station %d: I need one button GPIO for each of %d light pens\n", THIS_MODULE->name, index, nb_gpios - 1);
+        return -EINVAL;
+    }
 
-    err = copy_to_user(buffer, message, lg);
-    if (err != 0)
-        return -EFAULT;
-    have_data = false;
-    return lg;
+    for (i = 0; i < nb_gpios; ++i) {
+        gpio = gpio_ts_table[index][i];
+        if ((i == GPIO_TS_VSYNC_INDEX) && gpio_ts_vsync_drm)
+            continue;           // placeholder, VSYNC comes from DRM
+        if (!gpio_is_valid(gpio)) {
+            printk(KERN_ERR "%s: station %d: invalid gpio pin %d\n", THIS_MODULE->name, index, gpio);
+            return -ENODEV;
+        }
+    }
+
+    for (i = 0; i < nb_gpios - 1; ++i) {
+        gpio = gpio_lp_button[index][i];
+        if (!gpio_is_valid(gpio)) {
+            printk(KERN_ERR "%s: station %d: invalid gpio pin %d for light pen button input\n", THIS_MODULE->name, index, gpio);
+            return -ENODEV;
+        }
+    }
+
+    // negative: no odd/even line, fields alternate on every VSYNC
+    if ((gpio_odd_even[index] >= 0) && !gpio_is_valid(gpio_odd_even[index])) {
+        printk(KERN_ERR "%s: station %d: invalid gpio pin %d for odd/even frame indicator input\n", THIS_MODULE->name, index, gpio_odd_even[index]);
+        return -ENODEV;
+    }
+
+    return nb_gpios;
+}
+
+static void gpio_ts_free_station(struct gpio_ts_station *station) {
+    int i;
+
+    for (i = 0; i < station->nb_pens; i++) {
+        if (station->pens[i] != NULL)
+            gpio_ts_free_pen(station->pens[i]);
+    }
+    for (i = 0; i < station->nb_gpios; i++)
+        kfree(station->devtable[i]);
+    kfree(station);
+}
+
+static void gpio_ts_free_stations(void) {
+    struct gpio_ts_station *station;
+    int i;
+
+    for (i = 0; i < GPIO_TS_STATIONS_MAX; i++) {
+        // parameter callbacks walk stations[] under the parameter lock
+        kernel_param_lock(THIS_MODULE);
+        station = stations[i];
+        stations[i] = NULL;
+        kernel_param_unlock(THIS_MODULE);
+        if (station != NULL)
+            gpio_ts_free_station(station);
+    }
 }
 
 //
-// poll support: called when the user calls poll() on an open GPIO file, or when woken up
-// by the kernel following a waitqueue wake_up by the ISR
+// allocate station with its light pens and device info structures, minors start at minor
 //
-static unsigned int gpio_ts_poll(struct file *filp, struct poll_table_struct *polltable) {
-
+static struct gpio_ts_station *gpio_ts_alloc_station(int index, int minor) {
+    struct gpio_ts_station *station;
     struct gpio_ts_devinfo *devinfo;
+    int i;
 
-    // we have data, return the appropriate mask
-    if (have_data) {
-        return POLLPRI | POLLIN;
+    station = kzalloc(sizeof(struct gpio_ts_station), GFP_KERNEL);
+    if (station == NULL)
+        return NULL;
+    seqcount_init(&station->vsync.seq);
+    spin_lock_init(&station->inject_lock);
+    station->index = index;
+    station->minor = minor;
+    station->nb_gpios = gpio_ts_nb_gpios[index];
+    station->nb_pens = station->nb_gpios - 1;
+    station->gpios = gpio_ts_table[index];
+    station->gpio_button = gpio_lp_button[index];
+    station->gpio_odd_even = gpio_odd_even[index];
+    for (i = 0; i < GPIO_TS_NB_ENTRIES_MAX; i++)
+        station->irq_numbers[i] = -1;       // nothing requested yet
+
+    // light pen state, shared pages for mmap()
+    for (i = 0; i < station->nb_pens; i++) {
+        station->pens[i] = gpio_ts_alloc_pen(station, i);
+        if (station->pens[i] == NULL) {
+            gpio_ts_free_station(station);
+            return NULL;
+        }
     }
 
-    devinfo = filp->private_data;
+    for (i = 0; i < station->nb_gpios; i++) {
+        devinfo = kzalloc(sizeof(struct gpio_ts_devinfo), GFP_KERNEL);
+        if (devinfo == NULL) {
+            gpio_ts_free_station(station);
+            return NULL;
+        }
+        atomic_set(&devinfo->opencount, 0);
+        devinfo->num = i;
+        devinfo->station = station;
+        init_waitqueue_head(&devinfo->waitqueue);
+        if (i != GPIO_TS_VSYNC_INDEX) {
+            devinfo->pen = station->pens[(i == 0) ? 0 : i - 1];
+            devinfo->pen->devinfo = devinfo;
+        }
+        station->devtable[i] = devinfo;
+    }
 
-    // we have no data yet, put our wait queue in the kernel poll table
-    // so we can wait for a wake-up from the ISR when poll will be called again by the kernel
-    poll_wait(filp, &devinfo->waitqueue, polltable);
-    // return a zero mask so that we'll be put to sleep waiting on the waitqueue
-    return 0;
+    return station;
 }
 
-// ------------------ IRQ handler----------- ----------------------------
-
 //
-// handles GPIO interrupts
-// ignores interrupts when no file is open for the device
-// otherwise gets the current timestamp
-// then stores the timestamp in the fifo queue for this device 
-// and wakes up the associated waitqueue so that poll() gets woken up if it's waiting
-//  
-static irqreturn_t gpio_ts_handler(int irq, void *arg) {
+// export GPIOs of the station to sysfs and register the ISR for sensors and VSYNC
+// on failure everything of the station is released again
+//
+static int gpio_ts_setup_station(struct gpio_ts_station *station) {
+    unsigned long flags;
+    int err;
+    int i;
+    int gpio;
+    int irq;
 
-    struct timespec timestamp;
-    struct gpio_ts_devinfo *devinfo;
-    long usecs;
+    if (gpio_ts_input) {
+        err = gpio_ts_input_register(station);
+        if (err != 0) {
+            printk(KERN_ERR "%s: error %d registering input device for station %d\n", THIS_MODULE->name, err, station->index);
+            return err;
+        }
+        printk(KERN_INFO "%s: input device registered for station %d\n", THIS_MODULE->name, station->index);
+    }
 
-    if (module_unload) {
-        return -IRQ_NONE; // ignore if module is unloading
+    for (i = 0; i < station->nb_gpios; ++i) {
+        gpio = station->gpios[i];
+        if ((i == GPIO_TS_VSYNC_INDEX) && gpio_ts_vsync_drm) {
+            printk(KERN_INFO "%s: station %d VSYNC from DRM vblank, phase %d ns\n", THIS_MODULE->name, station->index, gpio_ts_vsync_phase_ns);
+            continue;
+        }
+        gpio_request(gpio, "sysfs");
+        gpio_direction_input(gpio);
+        gpio_export(gpio, false);
+        printk(KERN_INFO "%s: gpio %d exported to sysfs for input\n", THIS_MODULE->name, gpio);
+        if (gpio_ts_poll_cpu >= 0)
+            continue;           // the poll thread watches it
+        irq = gpio_to_irq(gpio);
+        printk(KERN_INFO "%s: gpio %d mapped to IRQ %d\n", THIS_MODULE->name, gpio, irq);
+        // sensors need both edges to measure pulse width
+        flags = IRQF_SHARED | IRQF_TRIGGER_RISING;
+        if ((i != GPIO_TS_VSYNC_INDEX) && gpio_ts_pulse_width)
+            flags |= IRQF_TRIGGER_FALLING;
+        if (gpio_ts_irq_threaded)
+            err = request_threaded_irq(irq, gpio_ts_hardirq, gpio_ts_irq_thread, flags | IRQF_ONESHOT, THIS_MODULE->name, station->devtable[i]);
+        else
+            err = request_irq(irq, gpio_ts_handler, flags, THIS_MODULE->name, station->devtable[i]);
+        if (err != 0) {
+            printk(KERN_ERR "%s: request_irq returned error %d for gpio %d\n", THIS_MODULE->name, err, gpio);
+            err = -ENODEV;
+            goto err_irq;
+        }
+        if (i == GPIO_TS_VSYNC_INDEX) {
+            printk(KERN_INFO "%s: gpio %d allocated for station %d VSYNC\n", THIS_MODULE->name, gpio, station->index);
+        } else {
+            station->devtable[i]->pen->irq = irq;
+            printk(KERN_INFO "%s: gpio %d allocated for station %d light pen %d sensor\n", THIS_MODULE->name, gpio, station->index, station->devtable[i]->pen->index);
+        }
+
+        station->irq_numbers[i] = irq;
     }
 
-    // first of all get the timestamp
-    getnstimeofday(&timestamp);
+    for (i = 0; i < station->nb_pens; ++i) {
+        gpio = station->gpio_button[i];
+        gpio_request(gpio, "sysfs");
+        gpio_direction_input(gpio);
+        gpio_export(gpio, false);
+        printk(KERN_INFO "%s: gpio %d allocated for station %d light pen %d button input\n", THIS_MODULE->name, gpio, station->index, i);
+    }
+    gpio = station->gpio_odd_even;
+    if (gpio >= 0) {
+        gpio_request(gpio, "sysfs");
+        gpio_direction_input(gpio);
+        gpio_export(gpio, false);
+        printk(KERN_INFO "%s: gpio %d allocated for station %d odd/even frame indicator input\n", THIS_MODULE->name, gpio, station->index);
+    }
 
-    // get the device info structure for this gpio from the file pointer
-    // note that it's just a pointer to devtable[gpio_index]
-    devinfo = (struct gpio_ts_devinfo *)arg;
+    return 0;
 
-    if (devinfo == NULL) {
-        return -IRQ_NONE;
+err_irq:
+    // gpios[i] is exported but has no interrupt
+    gpio_unexport(gpio);
+    gpio_free(gpio);
+    while (--i >= 0) {
+        if ((i == GPIO_TS_VSYNC_INDEX) && gpio_ts_vsync_drm)
+            continue;
+        if (station->irq_numbers[i] >= 0)
+            free_irq(station->irq_numbers[i], station->devtable[i]);
+        station->irq_numbers[i] = -1;
+        gpio_unexport(station->gpios[i]);
+        gpio_free(station->gpios[i]);
     }
+    if (station->input != NULL)
+        input_unregister_device(station->input);
+    station->input = NULL;
+    return err;
+}
 
-    // remember last timestamp
-    usecs = timestamp.tv_sec * 1000000 + timestamp.tv_nsec / 1000;
+//
+// unregister the ISRs and release GPIOs of the station
+//
+static void gpio_ts_release_station(struct gpio_ts_station *station) {
+    struct gpio_ts_pen *pen;
+    int i;
+    int gpio;
+    int irq;
 
-    // do we do calculations now?
-    if (devinfo->num==0) {      // if this is lp irq
-        oddeven = gpio_get_value(gpio_odd_even);
-        if (((usecs-lastlp)>128) && (oddeven!=0)) {        // need at least some lines of difference and only even/odd frame
-            lastlp = usecs;
-            lp_button = gpio_get_value(gpio_lp_button);
-            usecoffset = usecs - lastvsync;
-            ypos = usecoffset / PAL_LINE_LENGTH;
-            xpos = usecoffset - (ypos*PAL_LINE_LENGTH);
-            have_data = true;
-            wake_up(&devinfo->waitqueue);
+    // trigger mode might have left sensor interrupts disabled
+    for (i = 0; i < station->nb_pens; i++) {
+        pen = station->pens[i];
+        if (!pen->sensor_irq_enabled && (pen->irq > 0))
+            enable_irq(pen->irq);
+    }
+
+    // release IRQ's, clean up sysfs
+    for (i = 0; i < station->nb_gpios; i++) {
+        if ((i == GPIO_TS_VSYNC_INDEX) && gpio_ts_vsync_drm)
+            continue;
+        gpio = station->gpios[i];
+        irq = station->irq_numbers[i];
+        if (irq >= 0) {
+            irq_set_affinity_hint(irq, NULL);
+            free_irq(irq, station->devtable[i]);
+            station->irq_numbers[i] = -1;
         }
+        gpio_unexport(gpio);
+        gpio_free(gpio);
+        printk(KERN_INFO "%s: released gpio %d, irq %d\n", THIS_MODULE->name, gpio, irq);
     }
-    if (devinfo->num==1) {      // if this is vsync just remember about it
-        lastvsync = usecs;
-        lastlp = usecs;         // reset also time of lastlp, otherwise LP handler above might never run due to usecs-lastlp condition
+    for (i = 0; i < station->nb_pens; i++) {
+        gpio = station->gpio_button[i];
+        gpio_unexport(gpio);
+        gpio_free(gpio);
+        printk(KERN_INFO "%s: released gpio %d\n", THIS_MODULE->name, gpio);
+    }
+    gpio = station->gpio_odd_even;
+    if (gpio >= 0) {
+        gpio_unexport(gpio);
+        gpio_free(gpio);
+        printk(KERN_INFO "%s: released gpio %d\n", THIS_MODULE->name, gpio);
     }
 
-    return IRQ_HANDLED;
+    if (station->input != NULL)
+        input_unregister_device(station->input);
+    station->input = NULL;
 }
 
-// ------------------ Driver private global data ----------------------------
-
-static struct file_operations gpio_ts_fops = {
-    .owner = THIS_MODULE, 
-    .open = gpio_ts_open, 
-    .release = gpio_ts_release, 
-    .read = gpio_ts_read, 
-    .poll = gpio_ts_poll,
-};
-
-static dev_t gpio_ts_dev;
-static struct cdev gpio_ts_cdev;
-static struct class *gpio_ts_class = NULL;
+//
+// release the first count stations, with kernel_param_lock held
+//
+static void gpio_ts_release_stations(int count) {
+    int i;
 
-// ------------------ Driver init and exit methods --------------------------
+    for (i = 0; i < count; i++) {
+        if (stations[i] != NULL)
+            gpio_ts_release_station(stations[i]);
+    }
+}
 
 // 
 // initalize the device structures for each device
@@ -273,126 +2682,163 @@ static int __init gpio_ts_init(void) {
 
     int err;
     int i;
-    int gpio;
-    int irq;
-    struct gpio_ts_devinfo *devinfo;
-
-    have_data = false;
+    int n;
+    int minor;
+    struct gpio_ts_station *station;
 
     // zero device table 
-    for (i = 0; i < GPIO_TS_NB_ENTRIES_MAX; ++i) {
+    for (i = 0; i < GPIO_TS_MINORS_MAX; ++i) {
         devtable[i] = NULL;
     }
 
-    // sanity checks
-    if (gpio_ts_nb_gpios != 2) {
-        printk(KERN_ERR "%s: I need exactly two GPIO input (lp,vsync - in that order)\n", THIS_MODULE->name);
+    if (gpio_ts_input && ((gpio_ts_input_width < 1) || (gpio_ts_input_height < 1))) {
+        printk(KERN_ERR "%s: input_width and input_height must be positive\n", THIS_MODULE->name);
         return -EINVAL;
     }
 
-    for (i = 0; i < gpio_ts_nb_gpios; ++i) {
-        gpio = gpio_ts_table[i];
-        if (!gpio_is_valid(gpio)) {
-            printk(KERN_ERR "%s: invalid gpio pin %d\n", THIS_MODULE->name, gpio);
+    if (sysfs_streq(gpio_ts_timestamp_source, "cycles")) {
+        gpio_ts_cycles = gpio_ts_clock_init();
+        if (!gpio_ts_cycles) {
+            printk(KERN_ERR "%s: no usable cycle counter, timestamp_source=cycles not available\n", THIS_MODULE->name);
             return -ENODEV;
         }
+        printk(KERN_INFO "%s: cycle counter timestamps, %u ns per 2^%d cycles\n", THIS_MODULE->name, gpio_ts_clock_mult, GPIO_TS_CLOCK_SHIFT);
+    } else if (!sysfs_streq(gpio_ts_timestamp_source, "ktime")) {
+        printk(KERN_ERR "%s: timestamp_source must be ktime or cycles\n", THIS_MODULE->name);
+        return -EINVAL;
     }
 
-    if (!gpio_is_valid(gpio_lp_button)) {
-        printk(KERN_ERR "%s: invalid gpio pin %d for light pen button input\n", THIS_MODULE->name, gpio_lp_button);
-        return -ENODEV;
+    if ((gpio_ts_poll_cpu >= 0) && ((gpio_ts_poll_cpu >= nr_cpu_ids) || !cpu_online(gpio_ts_poll_cpu))) {
+        printk(KERN_ERR "%s: poll_cpu %d is not online\n", THIS_MODULE->name, gpio_ts_poll_cpu);
+        return -EINVAL;
     }
 
-    if (!gpio_is_valid(gpio_lp_button)) {
-        printk(KERN_ERR "%s: invalid gpio pin %d for odd/even frame indicator input\n", THIS_MODULE->name, gpio_odd_even);
-        return -ENODEV;
+    if (sysfs_streq(gpio_ts_vsync_source, "drm")) {
+        gpio_ts_vsync_drm = true;
+    } else if (!sysfs_streq(gpio_ts_vsync_source, "gpio")) {
+        printk(KERN_ERR "%s: vsync_source must be gpio or drm\n", THIS_MODULE->name);
+        return -EINVAL;
+    }
+
+    // check parameters of all stations before touching anything
+    for (n = 0; n < GPIO_TS_STATIONS_MAX; n++) {
+        err = gpio_ts_check_station(n);
+        if (err < 0)
+            return err;
+    }
+
+    // light pen state, shared pages for mmap(), device info
+    minor = 0;
+    for (n = 0; n < GPIO_TS_STATIONS_MAX; n++) {
+        if (gpio_ts_nb_gpios[n] == 0)
+            continue;
+        station = gpio_ts_alloc_station(n, minor);
+        if (station == NULL) {
+            err = -ENOMEM;
+            goto err_stations;
+        }
+        stations[n] = station;
+        for (i = 0; i < station->nb_gpios; i++)
+            devtable[minor + i] = station->devtable[i];
+        minor += station->nb_gpios;
+        gpio_ts_nb_stations++;
     }
+    gpio_ts_nb_minors = minor;
 
     // create the character devices
 
-    err = alloc_chrdev_region(&gpio_ts_dev, 0, gpio_ts_nb_gpios, THIS_MODULE->name);
+    err = alloc_chrdev_region(&gpio_ts_dev, 0, gpio_ts_nb_minors, THIS_MODULE->name);
     if (err != 0) {
         printk(KERN_ERR "%s: error %d allocating chdev_region\n", THIS_MODULE->name, err);
-        return err;
+        goto err_stations;
     }
     printk(KERN_INFO "%s: device region allocated, major number=%x\n", THIS_MODULE->name, gpio_ts_dev);
 
     gpio_ts_class = class_create(THIS_MODULE, GPIO_TS_CLASS_NAME);
     if (IS_ERR(gpio_ts_class)) {
         printk(KERN_ERR "%s: Could not create class %s\n", THIS_MODULE->name, GPIO_TS_CLASS_NAME);
-        unregister_chrdev_region(gpio_ts_dev, gpio_ts_nb_gpios);
-        return -EINVAL;
+        err = -EINVAL;
+        goto err_region;
     }
     printk(KERN_INFO "%s: device class created\n", THIS_MODULE->name);
 
-    for (i = 0; i < gpio_ts_nb_gpios; i++) {
-        device_create(gpio_ts_class, NULL, MKDEV(MAJOR(gpio_ts_dev), i), NULL, GPIO_TS_ENTRIES_NAME, i);
-        printk(KERN_INFO "%s: Device %d created\n", THIS_MODULE->name, i);
-        devinfo = kzalloc(sizeof(struct gpio_ts_devinfo), GFP_KERNEL);
-        if (devinfo == NULL)
-            return -ENOMEM;
-        devinfo->opencount = 0;
-        devinfo->num = i;
-        init_waitqueue_head(&devinfo->waitqueue);
-        devtable[i] = devinfo;
+    // first station keeps plain lightpen%d names, others are lightpen<station>.<n>
+    for (n = 0; n < GPIO_TS_STATIONS_MAX; n++) {
+        station = stations[n];
+        if (station == NULL)
+            continue;
+        for (i = 0; i < station->nb_gpios; i++) {
+            if (n == 0)
+                device_create(gpio_ts_class, NULL, MKDEV(MAJOR(gpio_ts_dev), station->minor + i), NULL, GPIO_TS_ENTRIES_NAME, i);
+            else
+                device_create(gpio_ts_class, NULL, MKDEV(MAJOR(gpio_ts_dev), station->minor + i), NULL, GPIO_TS_STATION_ENTRIES_NAME, n, i);
+            printk(KERN_INFO "%s: Device %d.%d created\n", THIS_MODULE->name, n, i);
+        }
     }
 
     cdev_init(&gpio_ts_cdev, &gpio_ts_fops);
 
-    err = cdev_add(&(gpio_ts_cdev), gpio_ts_dev, gpio_ts_nb_gpios);
-    if (err != 0) {
-        for (i = 0; i < gpio_ts_nb_gpios; i++) {
-            device_destroy(gpio_ts_class, MKDEV(MAJOR(gpio_ts_dev), i));
-            devinfo = devtable[i];
-            kfree(devinfo);
-        }
-        class_destroy(gpio_ts_class);
-        unregister_chrdev_region(gpio_ts_dev, gpio_ts_nb_gpios);
-        return err;
-    }
+    err = cdev_add(&(gpio_ts_cdev), gpio_ts_dev, gpio_ts_nb_minors);
+    if (err != 0)
+        goto err_devices;
 
     // set up sysfs and irqs
 
-    for (i = 0; i < gpio_ts_nb_gpios; ++i) {
-        gpio = gpio_ts_table[i];
-        gpio_request(gpio, "sysfs");
-        gpio_direction_input(gpio);
-        gpio_export(gpio, false);
-        printk(KERN_INFO "%s: gpio %d exported to sysfs for input\n", THIS_MODULE->name, gpio);
-        irq = gpio_to_irq(gpio);
-        printk(KERN_INFO "%s: gpio %d mapped to IRQ %d\n", THIS_MODULE->name, gpio, irq);
-        err = request_irq(irq, gpio_ts_handler, IRQF_SHARED | IRQF_TRIGGER_RISING, THIS_MODULE->name, devtable[i]);
+    kernel_param_lock(THIS_MODULE);
+    for (n = 0; n < GPIO_TS_STATIONS_MAX; n++) {
+        if (stations[n] == NULL)
+            continue;
+        err = gpio_ts_setup_station(stations[n]);
         if (err != 0) {
-            devinfo = devtable[i];
-            kfree(devinfo);
-            printk(KERN_ERR "%s: request_irq returned error %d for gpio %d\n", THIS_MODULE->name, err, gpio);
-            return -ENODEV;
-        }
-        switch (i) {
-            case 0:
-                printk(KERN_INFO "%s: gpio %d allocated for light pen sensor\n", THIS_MODULE->name, gpio);
-                break;
-            case 1:
-                printk(KERN_INFO "%s: gpio %d allocated for VSYNC\n", THIS_MODULE->name, gpio);
-                break;
-            default:
-                printk(KERN_INFO "%s: too many gpios %i\n", THIS_MODULE->name, i);
-                break;
+            // stations before n are fully set up, n cleaned up after itself
+            gpio_ts_release_stations(n);
+            kernel_param_unlock(THIS_MODULE);
+            goto err_cdev;
         }
+    }
+    gpio_ts_irq_affinity();
+    gpio_ts_irqs_ready = true;
+    if (gpio_ts_latency_learn_ms > 0) {
+        err = gpio_ts_latency_start(gpio_ts_latency_learn_ms);
+        if (err != 0)
+            printk(KERN_ERR "%s: error %d starting latency learning\n", THIS_MODULE->name, err);
+    }
+    kernel_param_unlock(THIS_MODULE);
 
-        irq_numbers[i] = irq;
+    if (gpio_ts_poll_cpu >= 0) {
+        err = gpio_ts_poll_start();
+        if (err != 0) {
+            printk(KERN_ERR "%s: error %d starting the poll thread\n", THIS_MODULE->name, err);
+            goto err_stations_setup;
+        }
     }
 
-    gpio_request(gpio_lp_button, "sysfs");
-    gpio_direction_input(gpio_lp_button);
-    gpio_export(gpio_lp_button, false);
-    printk(KERN_INFO "%s: gpio %d allocated for light pen button input\n", THIS_MODULE->name, gpio_lp_button);
-    gpio_request(gpio_odd_even, "sysfs");
-    gpio_direction_input(gpio_odd_even);
-    gpio_export(gpio_odd_even, false);
-    printk(KERN_INFO "%s: gpio %d allocated for odd/even frame indicator input\n", THIS_MODULE->name, gpio_odd_even);
+    gpio_ts_debugfs_init();
+
+    printk(KERN_INFO "%s: %d station(s) ready\n", THIS_MODULE->name, gpio_ts_nb_stations);
 
     return 0;
+
+err_stations_setup:
+    kernel_param_lock(THIS_MODULE);
+    gpio_ts_irqs_ready = false;
+    kernel_param_unlock(THIS_MODULE);
+    gpio_ts_latency_stop();
+    kernel_param_lock(THIS_MODULE);
+    gpio_ts_release_stations(GPIO_TS_STATIONS_MAX);
+    kernel_param_unlock(THIS_MODULE);
+err_cdev:
+    cdev_del(&gpio_ts_cdev);
+err_devices:
+    for (i = 0; i < gpio_ts_nb_minors; i++)
+        device_destroy(gpio_ts_class, MKDEV(MAJOR(gpio_ts_dev), i));
+    class_destroy(gpio_ts_class);
+    gpio_ts_class = NULL;
+err_region:
+    unregister_chrdev_region(gpio_ts_dev, gpio_ts_nb_minors);
+err_stations:
+    gpio_ts_free_stations();
+    return err;
 }
 
 //
@@ -403,42 +2849,37 @@ static int __init gpio_ts_init(void) {
 //
 void __exit gpio_ts_exit(void) {
     int i;
-    int gpio;
-    int irq;
 
     module_unload = true;
 
-    // release IRQ's, clean up sysfs 
-    for (i = 0; i < gpio_ts_nb_gpios; i++) {
-        gpio = gpio_ts_table[i];
-        irq = irq_numbers[i];
-        free_irq(irq, devtable[i]);
-        gpio_unexport(gpio);
-        gpio_free(gpio);
-        printk(KERN_INFO "%s: released gpio %d, irq %d\n", THIS_MODULE->name, gpio, irq);
-    }
-    gpio_unexport(gpio_lp_button);
-    gpio_free(gpio_lp_button);
-    printk(KERN_INFO "%s: released gpio %d\n", THIS_MODULE->name, gpio_lp_button);
-    gpio_unexport(gpio_odd_even);
-    gpio_free(gpio_odd_even);
-    printk(KERN_INFO "%s: released gpio %d\n", THIS_MODULE->name, gpio_odd_even);
+    debugfs_remove_recursive(gpio_ts_debugfs);
+    gpio_ts_debugfs = NULL;
+
+    if (gpio_ts_poll_task != NULL)
+        kthread_stop(gpio_ts_poll_task);
+    gpio_ts_poll_task = NULL;
+
+    kernel_param_lock(THIS_MODULE);
+    gpio_ts_irqs_ready = false;
+    kernel_param_unlock(THIS_MODULE);
+    gpio_ts_latency_stop();     // it walks the stations
+    kernel_param_lock(THIS_MODULE);
+    gpio_ts_release_stations(GPIO_TS_STATIONS_MAX);
+    kernel_param_unlock(THIS_MODULE);
 
     // clean up char devices
     cdev_del(&gpio_ts_cdev);
 
-    for (i = 0; i < gpio_ts_nb_gpios; i++)
+    for (i = 0; i < gpio_ts_nb_minors; i++)
         device_destroy(gpio_ts_class, MKDEV(MAJOR(gpio_ts_dev), i));
 
     class_destroy(gpio_ts_class);
     gpio_ts_class = NULL;
 
-    unregister_chrdev_region(gpio_ts_dev, gpio_ts_nb_gpios);
+    unregister_chrdev_region(gpio_ts_dev, gpio_ts_nb_minors);
 
     // and finally release device info memory
-    for (i = 0; i < gpio_ts_nb_gpios; i++) {
-        kfree(devtable[i]);
-    }
+    gpio_ts_free_stations();
 }
 
 module_init(gpio_ts_init);
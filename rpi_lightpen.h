@@ -0,0 +1,169 @@
+/***************************************************************************
+
+ Raspberry Pi GPIO lightpen driver - userspace interface
+
+ Copyright (c) 2020 Maciej Witkowiak
+
+ Shared between the kernel module and userspace programs,
+ include it to talk to /dev/lightpen0 through ioctl()
+
+ Licensed under The MIT License (MIT), see rpi_lightpen.c for details
+
+***************************************************************************/
+
+#ifndef _RPI_LIGHTPEN_H
+#define _RPI_LIGHTPEN_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+// ------------------ Read modes --------------------------------------------
+
+#define LIGHTPEN_MODE_COORDS    0   // "<x>,<y>,<b>\n" for every sample (default)
+#define LIGHTPEN_MODE_ZONES     1   // "<event>,<zone id>\n" on zone enter/leave/click only
+#define LIGHTPEN_MODE_TRIGGER   2   // "hit,<frame>,<x>,<y>\n" or "miss,<frame>\n" for the armed frame only
+#define LIGHTPEN_MODE_MACHINE   3   // "<x>,<y>,<b>\n" for every sample, in target machine beam coordinates
+#define LIGHTPEN_MODE_RECORD    4   // struct lightpen_record for every sample
+
+// ------------------ Binary record -----------------------------------------
+
+// one sample at full resolution, all times in nanoseconds
+struct lightpen_record {
+    __u64 timestamp;            // CLOCK_MONOTONIC time of the sensor event
+    __u32 offset;               // time since VSYNC
+    __u32 frame_period;         // measured VSYNC to VSYNC period
+    __u32 line_period;          // frame_period / 312.5 lines
+    __u32 frame;                // frame number (VSYNC count)
+    __s16 x, y;                 // raw column/line, same as LIGHTPEN_MODE_COORDS
+    __u8 button;                // light pen button, 0 is pressed
+    __u8 field;                 // odd/even line level, LIGHTPEN_FIELD_NODATA on read timeout
+    __u8 confidence;            // 0 (noise) to 255, from lines lit and pulse width, final after next VSYNC
+    __u8 lines;                 // consecutive lines that lit the sensor
+};
+
+// LIGHTPEN_IOC_SET_TIMEOUT expired: timestamp and frame are current, x/y are -1, the rest 0
+#define LIGHTPEN_FIELD_NODATA   0xff
+
+// ------------------ Shared memory page ------------------------------------
+
+#define LIGHTPEN_OFFSCREEN_FRAMES   3   // VSYNCs without a hit before pen is considered off-screen
+
+// VSYNC tracker of the pen's station, the beam is at line (t - timestamp) / line_period
+// (in ns, CLOCK_MONOTONIC) of the field, for any t until the next VSYNC
+struct lightpen_vsync {
+    __u64 timestamp;            // CLOCK_MONOTONIC time of the last VSYNC
+    __u32 frame_period;         // measured VSYNC to VSYNC period
+    __u32 line_period;          // frame_period / 312.5 lines
+    __u32 frame;                // frame number (VSYNC count)
+    __u8 field;                 // odd/even line level at VSYNC
+    __u8 reserved[3];
+};
+
+// read-only page mapped with mmap() on /dev/lightpen0, always up to date
+// seq is odd while the driver is writing, copy the page and retry if seq changed meanwhile
+struct lightpen_shared {
+    __u32 seq;                  // update sequence counter
+    __u32 frame;                // current frame number, updated on VSYNC
+    __u32 offscreen;            // no sensor hit for LIGHTPEN_OFFSCREEN_FRAMES VSYNCs
+    __u32 button;               // light pen button sampled on VSYNC, 0 is pressed
+    __s32 x, y;                 // calibrated screen position of the most recent sample
+    struct lightpen_record sample;      // most recent sample
+    struct lightpen_vsync vsync;        // updated on VSYNC
+};
+
+// ------------------ Calibration -------------------------------------------
+
+// raw column/line to screen pixels, 8.8 fixed-point, same math as lp-int.py:
+//   x = (((col - offsx) mod line length) * scalex) >> 8
+//   y = ((line - offsy) * scaley) >> 8
+struct lightpen_calib {
+    __s32 offsx;                // raw column of the left screen edge
+    __s32 offsy;                // raw line of the top screen edge
+    __s32 scalex;               // screen pixels per raw column (8.8)
+    __s32 scaley;               // screen pixels per raw line (8.8)
+};
+
+// ------------------ Screen zones ------------------------------------------
+
+#define LIGHTPEN_MAX_ZONES      16
+
+#define LIGHTPEN_ZONES_SCREEN   0x0001  // zones are in calibrated screen space, raw column/line otherwise
+
+// rectangle x0 <= x < x1, y0 <= y < y1, first matching zone wins
+struct lightpen_zone {
+    __s16 x0, y0;
+    __s16 x1, y1;
+    __u16 id;                   // reported back in zone events
+    __u16 reserved;
+};
+
+struct lightpen_zones {
+    __u32 count;                // number of valid entries in zone[]
+    __u32 flags;                // LIGHTPEN_ZONES_*
+    struct lightpen_zone zone[LIGHTPEN_MAX_ZONES];
+};
+
+// ------------------ Trigger mode ------------------------------------------
+
+#define LIGHTPEN_TRIGGER_BUTTON 0x0001  // arm on the next button press instead of a given frame
+
+// arm the flash frame; frame numbers count VSYNCs, see LIGHTPEN_IOC_GET_FRAME
+struct lightpen_trigger {
+    __u32 frame;                // frame to report on
+    __u32 flags;                // LIGHTPEN_TRIGGER_*
+    __u32 delay;                // with LIGHTPEN_TRIGGER_BUTTON: frames between trigger pull and flash frame
+};
+
+// ------------------ Target machine timing ---------------------------------
+
+#define LIGHTPEN_MACHINE_RAW        0   // 64 columns of 1us, same as LIGHTPEN_MODE_COORDS
+#define LIGHTPEN_MACHINE_C64_PAL    1   // VIC-II 6569: LPX in 2 pixel units (4 per cycle), LPY raster line
+#define LIGHTPEN_MACHINE_ATARI_PAL  2   // ANTIC: PENH in color clocks, PENV raster line / 2
+#define LIGHTPEN_MACHINE_CUSTOM     255 // all fields supplied by userspace
+
+// the PAL line after VSYNC is split into cycles, each one is units wide in the latch,
+// x wraps around at cycles*units and y at lines, just like the emulated counters do
+struct lightpen_machine {
+    __u32 id;                   // LIGHTPEN_MACHINE_*, presets below ignore the fields up to yshift
+    __u32 lines;                // raster lines per frame
+    __u32 cycles;               // clock cycles per raster line
+    __u32 units;                // latch units per cycle
+    __u32 yshift;               // low bits of the raster line dropped by the latch
+    __s32 xoffset;              // cycle latched at the beginning of the PAL line (horizontal alignment)
+    __s32 yoffset;              // raster line shown on the first line after VSYNC (vertical alignment)
+};
+
+// ------------------ eventfd notification ----------------------------------
+
+#define LIGHTPEN_EVENTFD_VSYNC  0x0001  // every VSYNC of the pen's station
+#define LIGHTPEN_EVENTFD_HIT    0x0002  // every accepted sensor hit (trigger mode: the flash frame hit)
+
+// one eventfd for each open file, signalled from the interrupt handler
+struct lightpen_eventfd {
+    __s32 fd;                   // eventfd(2) descriptor, -1 to unregister
+    __u32 flags;                // LIGHTPEN_EVENTFD_*
+};
+
+// ------------------ ioctl commands ----------------------------------------
+
+#define LIGHTPEN_IOC_MAGIC      'L'
+
+// _IO commands take the value itself as argument, not a pointer to it
+#define LIGHTPEN_IOC_SET_MODE   _IO(LIGHTPEN_IOC_MAGIC, 1)
+#define LIGHTPEN_IOC_SET_CALIB  _IOW(LIGHTPEN_IOC_MAGIC, 2, struct lightpen_calib)
+#define LIGHTPEN_IOC_SET_ZONES  _IOW(LIGHTPEN_IOC_MAGIC, 3, struct lightpen_zones)
+#define LIGHTPEN_IOC_ARM_TRIGGER _IOW(LIGHTPEN_IOC_MAGIC, 4, struct lightpen_trigger)
+#define LIGHTPEN_IOC_GET_FRAME  _IOR(LIGHTPEN_IOC_MAGIC, 5, __u32)
+#define LIGHTPEN_IOC_SET_MACHINE _IOWR(LIGHTPEN_IOC_MAGIC, 6, struct lightpen_machine)
+#define LIGHTPEN_IOC_SET_WATERMARK _IO(LIGHTPEN_IOC_MAGIC, 7)
+#define LIGHTPEN_IOC_SET_TIMEOUT _IO(LIGHTPEN_IOC_MAGIC, 8)
+#define LIGHTPEN_IOC_SET_EVENTFD _IOW(LIGHTPEN_IOC_MAGIC, 9, struct lightpen_eventfd)
+#define LIGHTPEN_IOC_GET_VSYNC  _IOR(LIGHTPEN_IOC_MAGIC, 10, struct lightpen_vsync)
+#define LIGHTPEN_IOC_INJECT_VSYNC _IOW(LIGHTPEN_IOC_MAGIC, 11, __u64)   // VSYNC device only, vsync_source=drm
+
+// LIGHTPEN_IOC_SET_WATERMARK: this file becomes readable after that many new records/events,
+// or at the end of every frame that had any
+#define LIGHTPEN_WATERMARK_FRAME    0
+#define LIGHTPEN_WATERMARK_MAX      32
+
+#endif
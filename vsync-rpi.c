@@ -1,33 +1,336 @@
+// VSYNC jitter analyzer
+//
+//  vsync [-s dispmanx|drm|lightpen|file] [-d device or file] [-t seconds] [-o text|csv] [-b bin us] [-w raw file]
+//
+// Timestamps (CLOCK_MONOTONIC ns) go into a buffer allocated before sampling starts, the statistics of the periods
+// between them are computed afterwards. -w saves the raw timestamps, one per line, which -s file reads back.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <stdarg.h>
+#include <string.h>
 #include <time.h>
-#include <assert.h>
 #include <unistd.h>
-#include <sys/time.h>
 
+#ifdef HAVE_DISPMANX
 #include "bcm_host.h"
+#endif
+#ifdef HAVE_LIBDRM
+#include <xf86drm.h>
+#endif
+
+#include "rpi_lightpen.h"
 
-static DISPMANX_DISPLAY_HANDLE_T   display;
-unsigned long lasttime = 0;
+#define MAX_RATE 200        // VSYNCs per second the buffer is sized for
+#define HIST_BINS_MAX 200
 
-void vsync(DISPMANX_UPDATE_HANDLE_T u, void* arg) {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    unsigned long microseconds = (tv.tv_sec*1000000)+tv.tv_usec;
-    printf("%lu\tsync %lu\n", microseconds,microseconds-lasttime);
-    lasttime = microseconds;
+static uint64_t *stamps;
+static unsigned int nb_stamps_max;
+static unsigned int nb_stamps;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
 }
 
-int main(void)
-{
-    bcm_host_init();
-    display = vc_dispmanx_display_open( 0 );
+// called from the timing path, may run on another thread (dispmanx)
+static void record(uint64_t t) {
+    unsigned int i = __atomic_fetch_add(&nb_stamps, 1, __ATOMIC_RELAXED);
+    if (i < nb_stamps_max)
+        stamps[i] = t;
+}
+
+// ------------------ Sources ---------------------------
+
+struct source {
+    const char *name;
+    const char *device;
+    int (*run)(const char *device, uint64_t end);  // sample until end, 0 or -1 with message printed
+};
 
-    vc_dispmanx_vsync_callback(display, vsync, NULL);
-    sleep(1);
+#ifdef HAVE_DISPMANX
+static void dispmanx_vsync(DISPMANX_UPDATE_HANDLE_T u, void *arg) {
+    record(now_ns());
+}
+
+static int dispmanx_run(const char *device, uint64_t end) {
+    DISPMANX_DISPLAY_HANDLE_T display;
+    uint64_t t;
+
+    bcm_host_init();
+    display = vc_dispmanx_display_open(atoi(device));
+    if (!display) {
+        fprintf(stderr, "can't open dispmanx display %s\n", device);
+        return -1;
+    }
+    vc_dispmanx_vsync_callback(display, dispmanx_vsync, NULL);
+    while ((t = now_ns()) < end)
+        usleep((end - t) / 1000);
     vc_dispmanx_vsync_callback(display, NULL, NULL); // disable callback
+    vc_dispmanx_display_close(display);
+    return 0;
+}
+#endif
+
+#ifdef HAVE_LIBDRM
+static int drm_request(int fd) {
+    drmVBlank vbl;
+
+    memset(&vbl, 0, sizeof(vbl));
+    vbl.request.type = DRM_VBLANK_RELATIVE | DRM_VBLANK_EVENT;
+    vbl.request.sequence = 1;
+    return drmWaitVBlank(fd, &vbl);
+}
+
+static void drm_vblank(int fd, unsigned int sequence, unsigned int sec, unsigned int usec, void *data) {
+    record((uint64_t)sec * 1000000000ull + (uint64_t)usec * 1000);
+    drm_request(fd);
+}
+
+static int drm_run(const char *device, uint64_t end) {
+    drmEventContext evctx = { .version = 2, .vblank_handler = drm_vblank };
+    struct pollfd pfd;
+    int fd;
+
+    fd = open(device, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "can't open %s: %s\n", device, strerror(errno));
+        return -1;
+    }
+    if (drm_request(fd) != 0) {
+        fprintf(stderr, "drmWaitVBlank: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    while (now_ns() < end) {
+        if ((poll(&pfd, 1, 100) > 0) && (pfd.revents & POLLIN))
+            drmHandleEvent(fd, &evctx);
+    }
+    close(fd);
+    return 0;
+}
+#endif
+
+static int lightpen_run(const char *device, uint64_t end) {
+    struct lightpen_vsync v;
+    struct pollfd pfd;
+    int fd;
+
+    fd = open(device, O_RDONLY | O_NONBLOCK);
+    if (fd < 0) {
+        fprintf(stderr, "can't open %s: %s\n", device, strerror(errno));
+        return -1;
+    }
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    while (now_ns() < end) {
+        if ((poll(&pfd, 1, 100) > 0) && (pfd.revents & POLLIN)) {
+            while (read(fd, &v, sizeof(v)) == sizeof(v))
+                record(v.timestamp);
+        }
+    }
+    close(fd);
+    return 0;
+}
+
+// one timestamp in ns per line, empty lines and lines starting with # are skipped, duration is ignored
+static int file_run(const char *device, uint64_t end) {
+    char line[128];
+    FILE *f;
 
-    vc_dispmanx_display_close( display );
+    f = strcmp(device, "-") ? fopen(device, "r") : stdin;
+    if (!f) {
+        fprintf(stderr, "can't open %s: %s\n", device, strerror(errno));
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        if ((line[0] == '#') || (line[0] == '\n'))
+            continue;
+        record(strtoull(line, NULL, 10));
+    }
+    if (f != stdin)
+        fclose(f);
     return 0;
-} 
+}
+
+static const struct source sources[] = {
+#ifdef HAVE_DISPMANX
+    { "dispmanx", "0", dispmanx_run },
+#endif
+#ifdef HAVE_LIBDRM
+    { "drm", "/dev/dri/card0", drm_run },
+#endif
+    { "lightpen", "/dev/lightpen1", lightpen_run },
+    { "file", "-", file_run },
+};
+
+#define NB_SOURCES (sizeof(sources) / sizeof(sources[0]))
+
+// ------------------ Statistics ------------------------
+
+static int cmp_period(const void *a, const void *b) {
+    int64_t pa = *(const int64_t *)a, pb = *(const int64_t *)b;
+    return (pa > pb) - (pa < pb);
+}
+
+// nearest rank on sorted periods
+static int64_t percentile(const int64_t *sorted, unsigned int n, double p) {
+    unsigned int rank = (unsigned int)ceil(p / 100 * n);
+    return sorted[rank ? rank - 1 : 0];
+}
+
+static void report(const int64_t *periods, unsigned int n, int csv, int64_t bin) {
+    static const double pct[] = { 1, 5, 50, 95, 99, 99.9 };
+    unsigned int hist[HIST_BINS_MAX];
+    double sum = 0, sq = 0, mean, d;
+    int64_t min = periods[0], max = periods[n - 1];
+    unsigned int i, nb_bins, peak = 0;
+
+    for (i = 0; i < n; i++)
+        sum += periods[i];
+    mean = sum / n;
+    for (i = 0; i < n; i++) {
+        d = periods[i] - mean;
+        sq += d * d;
+    }
+
+    if (bin <= 0)
+        bin = (max - min) / 20 > 1000 ? (max - min) / 20 : 1000;
+    nb_bins = (max - min) / bin + 1;
+    if (nb_bins > HIST_BINS_MAX) {
+        nb_bins = HIST_BINS_MAX;
+        bin = (max - min) / (HIST_BINS_MAX - 1) + 1;
+    }
+    memset(hist, 0, sizeof(hist));
+    for (i = 0; i < n; i++)
+        hist[(periods[i] - min) / bin]++;
+    for (i = 0; i < nb_bins; i++)
+        if (hist[i] > peak)
+            peak = hist[i];
+
+    if (csv) {
+        printf("stat,value_us\n");
+        printf("periods,%u\nmean,%.3f\nstddev,%.3f\nmin,%.3f\nmax,%.3f\n", n, mean / 1000,
+               n > 1 ? sqrt(sq / (n - 1)) / 1000 : 0, min / 1000.0, max / 1000.0);
+        for (i = 0; i < sizeof(pct) / sizeof(pct[0]); i++)
+            printf("p%g,%.3f\n", pct[i], percentile(periods, n, pct[i]) / 1000.0);
+        printf("\nbin_us,count\n");
+        for (i = 0; i < nb_bins; i++)
+            printf("%.3f,%u\n", (min + (int64_t)i * bin) / 1000.0, hist[i]);
+        return;
+    }
+
+    printf("periods %u  mean %.3f us  stddev %.3f us  min %.3f us  max %.3f us\n", n, mean / 1000,
+           n > 1 ? sqrt(sq / (n - 1)) / 1000 : 0, min / 1000.0, max / 1000.0);
+    for (i = 0; i < sizeof(pct) / sizeof(pct[0]); i++)
+        printf("p%-5g %12.3f us\n", pct[i], percentile(periods, n, pct[i]) / 1000.0);
+    printf("\n");
+    for (i = 0; i < nb_bins; i++) {
+        printf("%12.3f us %7u ", (min + (int64_t)i * bin) / 1000.0, hist[i]);
+        for (unsigned int j = 0; j < (hist[i] * 50 + peak - 1) / peak; j++)
+            putchar('#');
+        putchar('\n');
+    }
+}
+
+// ------------------ Main ------------------------------
+
+static void usage(const char *name) {
+    unsigned int i;
+
+    fprintf(stderr, "usage: %s [-s source] [-d device or file] [-t seconds] [-o text|csv] [-b bin us] [-w raw file]\n", name);
+    fprintf(stderr, "sources:");
+    for (i = 0; i < NB_SOURCES; i++)
+        fprintf(stderr, " %s (%s)", sources[i].name, sources[i].device);
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    const struct source *src = &sources[0];
+    const char *device = NULL;
+    const char *raw = NULL;
+    int64_t *periods;
+    int64_t bin = 0;
+    int seconds = 1;
+    int csv = 0;
+    unsigned int i, n;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:d:t:o:b:w:")) != -1) {
+        switch (opt) {
+            case 's':
+                for (i = 0; i < NB_SOURCES; i++)
+                    if (!strcmp(optarg, sources[i].name))
+                        break;
+                if (i == NB_SOURCES)
+                    usage(argv[0]);
+                src = &sources[i];
+                break;
+            case 'd': device = optarg; break;
+            case 't': seconds = atoi(optarg); break;
+            case 'o': csv = !strcmp(optarg, "csv"); break;
+            case 'b': bin = (int64_t)(atof(optarg) * 1000); break;
+            case 'w': raw = optarg; break;
+            default: usage(argv[0]);
+        }
+    }
+    if (seconds <= 0)
+        usage(argv[0]);
+    if (!device)
+        device = src->device;
+
+    // a trace file may be longer than any live run, size the buffer for a day of 50 Hz then
+    nb_stamps_max = (src->run == file_run) ? 50 * 86400 : (unsigned int)seconds * MAX_RATE + 16;
+    stamps = malloc(nb_stamps_max * sizeof(*stamps));
+    if (!stamps) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    memset(stamps, 0, nb_stamps_max * sizeof(*stamps));    // fault the pages in before sampling
+
+    if (src->run(device, now_ns() + (uint64_t)seconds * 1000000000ull) < 0)
+        return 1;
+
+    n = nb_stamps;
+    if (n > nb_stamps_max) {
+        fprintf(stderr, "%u VSYNCs did not fit the buffer\n", n - nb_stamps_max);
+        n = nb_stamps_max;
+    }
+    if (raw) {
+        FILE *f = fopen(raw, "w");
+        if (!f) {
+            fprintf(stderr, "can't write %s: %s\n", raw, strerror(errno));
+            return 1;
+        }
+        fprintf(f, "# %s %s\n", src->name, device);
+        for (i = 0; i < n; i++)
+            fprintf(f, "%llu\n", (unsigned long long)stamps[i]);
+        fclose(f);
+    }
+    if (n < 2) {
+        fprintf(stderr, "too few VSYNCs (%u)\n", n);
+        return 1;
+    }
+
+    periods = malloc((n - 1) * sizeof(*periods));
+    if (!periods) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    for (i = 0; i < n - 1; i++)
+        periods[i] = (int64_t)(stamps[i + 1] - stamps[i]);
+    qsort(periods, n - 1, sizeof(*periods), cmp_period);
+    report(periods, n - 1, csv, bin);
+
+    free(periods);
+    free(stamps);
+    return 0;
+}